@@ -0,0 +1,198 @@
+//
+// Created by diex on 10/17/2026.
+//
+
+#ifndef GOMOKU_MCTS_C_ARENA_H
+#define GOMOKU_MCTS_C_ARENA_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+// Huge page backing needs anonymous mappings, which strict ISO C modes hide
+#if defined(__linux__) && defined(MAP_ANONYMOUS)
+#define ARENA_HAS_MMAP 1
+#endif
+
+// Every allocation is aligned to this many bytes
+#define ARENA_ALIGNMENT 16
+// The default size of a slab, one huge page on x86-64
+#define ARENA_DEFAULT_SLAB_SIZE (2 * 1024 * 1024)
+
+// A slab is one large block of memory, its header is followed by the data
+typedef struct arenaSlab {
+    struct arenaSlab *next;
+    size_t size; // The number of bytes of data in the slab
+    size_t used; // The number of bytes handed out from the slab
+    int is_mapped; // 1 if the slab came from mmap rather than malloc
+} ArenaSlab;
+
+// The slab header rounded up so the data after it stays aligned
+#define ARENA_SLAB_HEADER ((sizeof(ArenaSlab) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+// Define the Arena struct
+// Memory is bump allocated out of a list of slabs. Nothing is freed on its own,
+// arena_reset releases everything at once and keeps the slabs for reuse.
+typedef struct {
+    ArenaSlab *first;
+    ArenaSlab *current; // The slab allocations are currently taken from
+    size_t slab_size;
+    int use_hugepages; // Back the slabs with huge pages when the platform allows it
+    size_t bytes_reserved; // The total size of all slabs
+    size_t bytes_used; // The bytes handed out since the last reset
+    int is_shared; // 1 if several threads allocate from the arena, allocations then take the lock
+    pthread_mutex_t lock;
+} Arena;
+
+// Initialize the arena, no memory is reserved until the first allocation
+void arena_init(Arena *arena, size_t slab_size, int use_hugepages) {
+    arena->first = NULL;
+    arena->current = NULL;
+    arena->slab_size = slab_size;
+    arena->use_hugepages = use_hugepages;
+    arena->bytes_reserved = 0;
+    arena->bytes_used = 0;
+    arena->is_shared = 0;
+    pthread_mutex_init(&arena->lock, NULL);
+}
+
+// Get a new slab that can hold at least size bytes of data
+ArenaSlab *arena_new_slab(Arena *arena, size_t size) {
+    size_t total = ARENA_SLAB_HEADER + size;
+    ArenaSlab *slab = NULL;
+    int is_mapped = 0;
+#ifdef ARENA_HAS_MMAP
+    if (arena->use_hugepages) {
+        // Round up to whole huge pages, try explicit huge pages first, then ask for transparent ones
+        size_t huge_page = ARENA_DEFAULT_SLAB_SIZE;
+        total = (total + huge_page - 1) & ~(huge_page - 1);
+        void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        p = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+        if (p == MAP_FAILED) {
+            p = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+            if (p != MAP_FAILED) {
+                madvise(p, total, MADV_HUGEPAGE);
+            }
+#endif
+        }
+        if (p != MAP_FAILED) {
+            slab = (ArenaSlab*)p;
+            is_mapped = 1;
+        }
+    }
+#endif
+    if (slab == NULL) {
+        slab = (ArenaSlab*)malloc(total);
+        if (slab == NULL) {
+            printf("Out of memory allocating a %zu byte arena slab.\n", total);
+            exit(1);
+        }
+    }
+    slab->next = NULL;
+    slab->size = total - ARENA_SLAB_HEADER;
+    slab->used = 0;
+    slab->is_mapped = is_mapped;
+    arena->bytes_reserved += total;
+    return slab;
+}
+
+// Return the start of the data in a slab
+char *arena_slab_data(ArenaSlab *slab) {
+    return (char*)slab + ARENA_SLAB_HEADER;
+}
+
+// Return the bytes arena_alloc hands out for a request of size bytes
+size_t arena_round_size(size_t size) {
+    return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+// Allocate size bytes from the arena
+void *arena_alloc(Arena *arena, size_t size) {
+    if (arena->is_shared) {
+        pthread_mutex_lock(&arena->lock);
+    }
+    size = arena_round_size(size);
+    ArenaSlab *slab = arena->current;
+    // Move on to the next slab until one has room, adding a new one after the last
+    while (slab == NULL || slab->used + size > slab->size) {
+        ArenaSlab *next = slab != NULL ? slab->next : arena->first;
+        if (next == NULL) {
+            next = arena_new_slab(arena, size > arena->slab_size ? size : arena->slab_size);
+            if (slab != NULL) {
+                slab->next = next;
+            } else {
+                arena->first = next;
+            }
+        } else {
+            next->used = 0;
+        }
+        slab = next;
+    }
+    arena->current = slab;
+    void *p = arena_slab_data(slab) + slab->used;
+    slab->used += size;
+    // Read without the lock to tell when the tree is full
+    __atomic_store_n(&arena->bytes_used, arena->bytes_used + size, __ATOMIC_RELAXED);
+    if (arena->is_shared) {
+        pthread_mutex_unlock(&arena->lock);
+    }
+    return p;
+}
+
+// Release everything allocated from the arena at once
+// The slabs are kept, and each one is cleared when allocation reaches it again
+void arena_reset(Arena *arena) {
+    arena->current = arena->first;
+    arena->bytes_used = 0;
+    if (arena->first != NULL) {
+        arena->first->used = 0;
+    }
+}
+
+// Exchange the memory of two arenas, each keeps its own lock and settings
+void arena_swap(Arena *a, Arena *b) {
+    ArenaSlab *first = a->first, *current = a->current;
+    size_t slab_size = a->slab_size, bytes_reserved = a->bytes_reserved, bytes_used = a->bytes_used;
+    a->first = b->first;
+    a->current = b->current;
+    a->slab_size = b->slab_size;
+    a->bytes_reserved = b->bytes_reserved;
+    a->bytes_used = b->bytes_used;
+    b->first = first;
+    b->current = current;
+    b->slab_size = slab_size;
+    b->bytes_reserved = bytes_reserved;
+    b->bytes_used = bytes_used;
+}
+
+// Return the slabs of the arena to the system
+void arena_free(Arena *arena) {
+    ArenaSlab *slab = arena->first;
+    while (slab != NULL) {
+        ArenaSlab *next = slab->next;
+#ifdef ARENA_HAS_MMAP
+        if (slab->is_mapped) {
+            munmap(slab, ARENA_SLAB_HEADER + slab->size);
+            slab = next;
+            continue;
+        }
+#endif
+        free(slab);
+        slab = next;
+    }
+    arena->first = NULL;
+    arena->current = NULL;
+    arena->bytes_reserved = 0;
+    arena->bytes_used = 0;
+    pthread_mutex_destroy(&arena->lock);
+}
+
+#endif //GOMOKU_MCTS_C_ARENA_H
@@ -0,0 +1,318 @@
+// clock_gettime, CLOCK_MONOTONIC and MAP_ANONYMOUS are POSIX, hidden by a strict -std=c11 unless asked for
+// before the first system header
+#define _DEFAULT_SOURCE
+#include <string.h>
+#include "game.h"
+
+// Reproducible benchmarks of the board, the rollout policy, selection, the network and the whole search
+// Every position and every random choice comes from the seed, so two runs with the same seed do the
+// same work. Each result is printed as one JSON object per line, so runs can be compared by a script.
+// Usage: gomoku_bench [--seed n] [--playout n] [--scale x]
+
+// Keeps the results of the micro benchmarks alive, so the compiler cannot drop the work
+volatile long bench_sink;
+
+const char *bench_phase_names[3] = {"opening", "midgame", "endgame"};
+
+// Return 1 if player can make n_in_row or an open four with one stone on b
+int bench_has_threat(Board *b, int player) {
+    for (int i = 0; i < b->moves_available_count; ++i) {
+        int move = b->moves_available[i];
+        if (board_is_winning_move(b, player, move) || board_is_open_four_move(b, player, move)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Play a position of the given phase on b with seeded random moves near the stones
+// The opening has 4 stones, the midgame a sixth of the board and the endgame a third
+// No move makes a four or an open three, so neither side has a win in hand
+void bench_play_position(Board *b, int size, int phase, uint64_t seed) {
+    int n_stones = phase == 0 ? 4 : phase == 1 ? size * size / 6 : size * size / 3;
+    uint64_t rng = seed | 1;
+    board_init(b, 0, size, size, 5);
+    board_do_move(b, (size / 2) * size + size / 2);
+    // Give up on more stones if every move tried makes a threat
+    for (int tries = 0; b->n_moves < n_stones && tries < 100 * n_stones; ++tries) {
+        int count = b->candidates_count > 0 ? b->candidates_count : b->moves_available_count;
+        int *moves = b->candidates_count > 0 ? b->candidates : b->moves_available;
+        int move = moves[mcts_random(&rng) % count];
+        int player = b->current_player;
+        board_do_move(b, move);
+        if (b->winner != -1 || bench_has_threat(b, player)) {
+            board_undo_move(b);
+        }
+    }
+}
+
+// Fill b with a position of the given phase that the threat solver cannot settle at the root,
+// so a search of it has real work to do; the positions depend only on the seed
+void bench_make_position(Board *b, int size, int phase, uint64_t seed) {
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        bench_play_position(b, size, phase, seed + attempt * 0x9E3779B97F4A7C15ULL);
+        MCTS mcts;
+        mcts_init(&mcts, 5, 1);
+        int action;
+        mcts_get_action(&mcts, b, &action);
+        int is_open = mcts.root->proven == TREE_NODE_UNPROVEN;
+        mcts_free(&mcts);
+        if (is_open) {
+            return;
+        }
+    }
+}
+
+// Print the result of a micro benchmark that ran n_ops operations
+void bench_report_micro(const char *name, int size, int phase, long n_ops, uint64_t elapsed_ns) {
+    printf("{\"bench\":\"%s\",\"size\":%d,\"phase\":\"%s\",\"ops\":%ld,\"ns_per_op\":%.2f}\n", name, size,
+           bench_phase_names[phase], n_ops, (double)elapsed_ns / (double)n_ops);
+}
+
+// A move followed by its undo, over every available move of the position
+void bench_do_move(Board *b, int size, int phase, long n_ops) {
+    Board copy;
+    board_copy(b, &copy);
+    long sink = 0, done = 0;
+    uint64_t start_ns = timer_now_ns();
+    while (done < n_ops) {
+        for (int i = 0; i < copy.moves_available_count && done < n_ops; ++i, ++done) {
+            int move = copy.moves_available[i];
+            board_do_move(&copy, move);
+            sink += copy.winner;
+            board_undo_move(&copy);
+        }
+    }
+    bench_report_micro("board_do_move+undo", size, phase, done, timer_now_ns() - start_ns);
+    bench_sink = sink;
+}
+
+// The moves played one after another for the separate timings of board_do_move and board_undo_move
+#define BENCH_MOVE_RUN 32
+
+// board_do_move and board_undo_move timed apart: a run of moves is played, then taken back, and
+// each half is timed as a whole, so the clock costs little against the moves
+void bench_do_and_undo(Board *b, int size, int phase, long n_ops) {
+    Board copy;
+    board_copy(b, &copy);
+    int n_run = copy.moves_available_count < BENCH_MOVE_RUN ? copy.moves_available_count : BENCH_MOVE_RUN;
+    int moves[BENCH_MOVE_RUN];
+    memcpy(moves, copy.moves_available, n_run * sizeof(int));
+    long sink = 0, done = 0;
+    uint64_t do_ns = 0, undo_ns = 0;
+    while (done < n_ops) {
+        uint64_t start_ns = timer_now_ns();
+        for (int i = 0; i < n_run; ++i) {
+            board_do_move(&copy, moves[i]);
+        }
+        uint64_t middle_ns = timer_now_ns();
+        sink += copy.winner;
+        for (int i = 0; i < n_run; ++i) {
+            board_undo_move(&copy);
+        }
+        uint64_t end_ns = timer_now_ns();
+        do_ns += middle_ns - start_ns;
+        undo_ns += end_ns - middle_ns;
+        done += n_run;
+    }
+    bench_report_micro("board_do_move", size, phase, done, do_ns);
+    bench_report_micro("board_undo_move", size, phase, done, undo_ns);
+    bench_sink = sink;
+}
+
+// The end check after each move of a cycle of moves
+void bench_check_end(Board *b, int size, int phase, long n_ops) {
+    Board copy;
+    board_copy(b, &copy);
+    int n_moves = copy.moves_available_count < 64 ? copy.moves_available_count : 64;
+    int moves[64];
+    memcpy(moves, copy.moves_available, n_moves * sizeof(int));
+    long sink = 0;
+    uint64_t elapsed_ns = 0;
+    for (long done = 0; done < n_ops; done += n_moves) {
+        for (int i = 0; i < n_moves; ++i) {
+            board_do_move(&copy, moves[i]);
+            int is_end, winner;
+            uint64_t start_ns = timer_now_ns();
+            for (int j = 0; j < 64; ++j) {
+                board_check_end(&copy, &is_end, &winner);
+                sink += is_end + winner;
+            }
+            elapsed_ns += timer_now_ns() - start_ns;
+            board_undo_move(&copy);
+        }
+    }
+    bench_report_micro("board_check_end", size, phase, (n_ops + n_moves - 1) / n_moves * n_moves * 64, elapsed_ns);
+    bench_sink = sink;
+}
+
+void bench_copy(Board *b, int size, int phase, long n_ops) {
+    Board copy;
+    long sink = 0;
+    uint64_t start_ns = timer_now_ns();
+    for (long i = 0; i < n_ops; ++i) {
+        board_copy(b, &copy);
+        // Make the copy look used, so it is not elided
+        __asm__ volatile("" : : "r"(&copy) : "memory");
+        sink += copy.n_moves;
+    }
+    bench_report_micro("board_copy", size, phase, n_ops, timer_now_ns() - start_ns);
+    bench_sink = sink;
+}
+
+// One move choice of the rollout policy, without playing it
+void bench_rollout_policy(Board *b, int size, int phase, long n_ops, uint64_t seed) {
+    uint64_t rng = seed | 1;
+    long sink = 0;
+    uint64_t start_ns = timer_now_ns();
+    for (long i = 0; i < n_ops; ++i) {
+        sink += rollout_policy_function(b, &rng);
+    }
+    bench_report_micro("rollout_policy_function", size, phase, n_ops, timer_now_ns() - start_ns);
+    bench_sink = sink;
+}
+
+// Selection at a node expanded at the position, whose edges carry seeded statistics
+// tree_node_best_edge scores the edges, and tree_node_select adds finding or creating the chosen child
+void bench_select(Board *b, int size, int phase, long n_ops, uint64_t seed) {
+    Arena arena;
+    arena_init(&arena, ARENA_DEFAULT_SLAB_SIZE, 0);
+    TreeNode node;
+    tree_node_init(&node, NULL, -1);
+    int actions[BOARD_MAX_CELLS];
+    double probs[BOARD_MAX_CELLS];
+    int count;
+    policy_value_function(b, actions, probs, &count);
+    tree_node_claim(&node);
+    tree_node_expand(&node, &arena, actions, probs, count);
+    uint64_t rng = seed | 1;
+    for (int i = 0; i < node.n_children; ++i) {
+        node.edge_visits[i] = (int)(mcts_random(&rng) % 100);
+        node.edge_value_sums[i] = (float)node.edge_visits[i] * ((float)(mcts_random(&rng) % 2001) / 1000.0f - 1.0f);
+        node.n_visits += node.edge_visits[i];
+    }
+    long sink = 0;
+    uint64_t start_ns = timer_now_ns();
+    for (long i = 0; i < n_ops; ++i) {
+        sink += tree_node_best_edge(&node, 5.0);
+    }
+    bench_report_micro("tree_node_best_edge", size, phase, n_ops, timer_now_ns() - start_ns);
+    // Without virtual loss the statistics stay the same, so every call selects the same edge and
+    // only the first creates its child
+    start_ns = timer_now_ns();
+    for (long i = 0; i < n_ops; ++i) {
+        int action, is_new;
+        TreeNode *child;
+        tree_node_select(&node, &arena, 5.0, 0, &action, &child, &is_new);
+        sink += action + is_new;
+    }
+    bench_report_micro("tree_node_select", size, phase, n_ops, timer_now_ns() - start_ns);
+    bench_sink = sink;
+    arena_free(&arena);
+}
+
+// Return the number of nodes in the tree below node
+long bench_count_nodes(TreeNode *node) {
+    long count = 1;
+    for (int i = 0; i < node->n_children; ++i) {
+        if (node->children[i] != NULL) {
+            count += bench_count_nodes(node->children[i]);
+        }
+    }
+    return count;
+}
+
+// Rollouts from the position to the end of the game
+void bench_rollouts(Board *b, int size, int phase, int n_rollouts, uint64_t seed) {
+    uint64_t rng = seed | 1;
+    long n_moves = 0;
+    uint64_t start_ns = timer_now_ns();
+    for (int i = 0; i < n_rollouts; ++i) {
+        Board copy;
+        board_copy(b, &copy);
+        mcts_rollout(&copy, MCTS_ROUND_LIMIT, &rng);
+        n_moves += copy.n_moves - b->n_moves;
+    }
+    double seconds = (double)(timer_now_ns() - start_ns) * 1e-9;
+    printf("{\"bench\":\"rollout\",\"size\":%d,\"phase\":\"%s\",\"rollouts\":%d,\"seconds\":%.4f,"
+           "\"rollouts_per_s\":%.1f,\"avg_length\":%.2f}\n", size, bench_phase_names[phase], n_rollouts, seconds,
+           n_rollouts / seconds, (double)n_moves / n_rollouts);
+}
+
+// One search of n_playout playouts from the position, on one thread
+void bench_search(Board *b, int size, int phase, int n_playout, uint64_t seed) {
+    MCTS mcts;
+    mcts_init(&mcts, 5, n_playout);
+    mcts.rng = seed | 1;
+    int action;
+    uint64_t start_ns = timer_now_ns();
+    mcts_get_action(&mcts, b, &action);
+    double seconds = (double)(timer_now_ns() - start_ns) * 1e-9;
+    long n_nodes = bench_count_nodes(mcts.root);
+    int n_visits = mcts.root->n_visits;
+    printf("{\"bench\":\"search\",\"size\":%d,\"phase\":\"%s\",\"playouts\":%d,\"nodes\":%ld,\"seconds\":%.4f,"
+           "\"playouts_per_s\":%.1f,\"nodes_per_s\":%.1f,\"move\":%d}\n", size, bench_phase_names[phase], n_visits,
+           n_nodes, seconds, n_visits / seconds, n_nodes / seconds, action);
+    mcts_free(&mcts);
+}
+
+// The network of the batch benchmark, a small one as the search would use on the CPU
+#define BENCH_NN_CHANNELS 32
+#define BENCH_NN_BLOCKS 4
+#define BENCH_NN_BATCH 16
+
+// Positions per second of nn_evaluate on a seeded random network, with float and then int8 convolutions
+void bench_nn(int size, int n_batches, uint64_t seed) {
+    NeuralNet net;
+    nn_init_random(&net, BENCH_NN_CHANNELS, BENCH_NN_BLOCKS, BENCH_NN_CHANNELS, seed);
+    for (int is_int8 = 0; is_int8 <= 1; ++is_int8) {
+        if (is_int8) {
+            nn_quantize(&net);
+        }
+        double rate = nn_benchmark(&net, size, BENCH_NN_BATCH, n_batches);
+        printf("{\"bench\":\"nn_batch\",\"size\":%d,\"precision\":\"%s\",\"channels\":%d,\"blocks\":%d,"
+               "\"batch\":%d,\"batches\":%d,\"positions_per_s\":%.1f}\n", size, is_int8 ? "int8" : "float",
+               BENCH_NN_CHANNELS, BENCH_NN_BLOCKS, BENCH_NN_BATCH, n_batches, rate);
+    }
+    nn_free(&net);
+}
+
+int main(int argc, char **argv) {
+    uint64_t seed = 12345;
+    int n_playout = 5000;
+    double scale = 1.0; // Multiplies the work of every benchmark
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--seed") == 0) {
+            seed = strtoull(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "--playout") == 0) {
+            n_playout = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--scale") == 0) {
+            scale = atof(argv[i + 1]);
+        } else {
+            printf("Unknown option %s.\n", argv[i]);
+            return 1;
+        }
+    }
+    // mcts_init seeds from rand(), which the benchmarks then override
+    srand((unsigned)seed);
+    int sizes[3] = {9, 15, 19};
+    long n_ops = (long)(1000000 * scale);
+    for (int s = 0; s < 3; ++s) {
+        for (int phase = 0; phase < 3; ++phase) {
+            Board b;
+            uint64_t position_seed = seed * 31 + sizes[s] * 3 + phase;
+            bench_make_position(&b, sizes[s], phase, position_seed);
+            bench_do_move(&b, sizes[s], phase, n_ops);
+            bench_do_and_undo(&b, sizes[s], phase, n_ops);
+            bench_check_end(&b, sizes[s], phase, n_ops);
+            bench_copy(&b, sizes[s], phase, n_ops / 4);
+            bench_rollout_policy(&b, sizes[s], phase, n_ops, position_seed);
+            bench_select(&b, sizes[s], phase, n_ops, position_seed);
+            bench_rollouts(&b, sizes[s], phase, (int)(2000 * scale) + 1, position_seed);
+            bench_search(&b, sizes[s], phase, (int)(n_playout * scale) + 1, position_seed);
+            board_free(&b);
+        }
+        bench_nn(sizes[s], (int)(8 * scale) + 1, seed);
+    }
+    return 0;
+}
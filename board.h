@@ -5,15 +5,85 @@
 #ifndef GOMOKU_MCTS_C_BOARD_H
 #define GOMOKU_MCTS_C_BOARD_H
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+// The largest supported board side. Every line of the board must fit in a BoardLine.
+#ifndef BOARD_MAX_SIZE
+#define BOARD_MAX_SIZE 19
+#endif
+#define BOARD_MAX_CELLS (BOARD_MAX_SIZE * BOARD_MAX_SIZE)
+#define BOARD_MAX_DIAGONALS (2 * BOARD_MAX_SIZE - 1)
+
+// Empty squares within this many squares of a stone, in any direction, are candidate moves
+#ifndef BOARD_CANDIDATE_RADIUS
+#define BOARD_CANDIDATE_RADIUS 2
+#endif
+
+// One bit per square along a row, column or diagonal
+typedef uint32_t BoardLine;
+
+// The four line directions through a square: row, column, diagonal and anti-diagonal
+#define BOARD_DIRECTIONS 4
+
+// The rule sets. Under Renju, black (the first player) may not make an overline, a double four
+// or a double three, and only an exact five wins for black; Renju needs n_in_row = 5
+#define BOARD_RULE_FREESTYLE 0
+#define BOARD_RULE_RENJU 1
+
+// Zobrist keys, one per player per square plus one for the side to move
+// They come from a fixed seed so hashes are the same in every run
+uint64_t board_zobrist[2][BOARD_MAX_CELLS];
+uint64_t board_zobrist_side;
+int board_zobrist_ready = 0;
+
+// Fill the Zobrist keys with splitmix64 output
+void board_zobrist_init(void) {
+    if (board_zobrist_ready) {
+        return;
+    }
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for (int p = 0; p < 2; ++p) {
+        for (int i = 0; i < BOARD_MAX_CELLS; ++i) {
+            uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            board_zobrist[p][i] = z ^ (z >> 31);
+        }
+    }
+    board_zobrist_side = 0xD6E8FEB86659FD93ULL;
+    board_zobrist_ready = 1;
+}
+
 // Define the Board struct
+// Stones are kept as two bitboard planes, one per player. Each plane is stored
+// in four shifted views so that every row, column, diagonal and anti-diagonal
+// is a contiguous bit string, and n-in-a-row checks become shift-and-AND.
+// The board owns no heap memory, so copying it is a plain struct copy.
 typedef struct {
     int width, height;
     int n_in_row; // How many pieces in a row to win, default 5
-    int **states; // An array of square states
+    int rule; // BOARD_RULE_FREESTYLE or BOARD_RULE_RENJU
+    int black; // The player who moved first, who is bound by the Renju restrictions
     int current_player;
-    int *moves_available; // Dynamic array of available moves
+    int moves_available[BOARD_MAX_CELLS]; // Dense list of the empty squares, only the first moves_available_count are valid
+    int moves_available_index[BOARD_MAX_CELLS]; // Position of each square in moves_available
     int moves_available_count; // The number of available moves
     int last_move; // The last move made, -1 if no move has been made
+    int moves[BOARD_MAX_CELLS]; // Stack of the moves made so far, used by board_undo_move
+    int n_moves; // The number of moves on the stack
+    uint64_t hash; // Zobrist hash of the stones and the side to move, updated incrementally
+    int last_runs[BOARD_DIRECTIONS]; // The length of the run through the last move in each direction
+    int winner; // The player whose last move made n_in_row, -1 if none
+    unsigned char near_count[BOARD_MAX_CELLS]; // The number of stones within BOARD_CANDIDATE_RADIUS of each square
+    int candidates[BOARD_MAX_CELLS]; // Dense list of the empty squares with a stone nearby
+    int candidates_index[BOARD_MAX_CELLS]; // Position of each square in candidates
+    int candidates_count;
+    BoardLine rows[2][BOARD_MAX_SIZE]; // rows[player][y], bit x
+    BoardLine cols[2][BOARD_MAX_SIZE]; // cols[player][x], bit y
+    BoardLine diags[2][BOARD_MAX_DIAGONALS]; // diags[player][x - y + height - 1], bit x
+    BoardLine anti_diags[2][BOARD_MAX_DIAGONALS]; // anti_diags[player][x + y], bit x
 } Board;
 
 // Initialize the board
@@ -22,52 +92,59 @@ void board_init(Board *b, int start_player, int width, int height, int n_in_row)
         printf("Board width and height cannot be less than %d.\n", n_in_row);
         exit(1);
     }
+    if (width > BOARD_MAX_SIZE || height > BOARD_MAX_SIZE) {
+        printf("Board width and height cannot be greater than %d.\n", BOARD_MAX_SIZE);
+        exit(1);
+    }
 
     b->width = width;
     b->height = height;
     b->n_in_row = n_in_row;
+    b->rule = BOARD_RULE_FREESTYLE;
+    b->black = start_player;
     b->current_player = start_player;
-
-    // Initialize the moves available with 0,1, 2, ..., width * height - 1
-    b->moves_available = (int*)malloc(width * height * sizeof(int));
+    // Initialize the moves available with 0, 1, 2, ..., width * height - 1
     for (int i = 0; i < width * height; ++i) {
         b->moves_available[i] = i;
+        b->moves_available_index[i] = i;
     }
     b->moves_available_count = width * height;
-    // Initialize the states with -1, which means an empty square
-    b->states = (int**)malloc(width * sizeof(int*));
-    for (int i = 0; i < width; ++i) {
-        b->states[i] = (int*)malloc(height * sizeof(int));
-        for (int j = 0; j < height; ++j) {
-            b->states[i][j] = -1;
+    // No square has a stone nearby yet
+    for (int i = 0; i < BOARD_MAX_CELLS; ++i) {
+        b->near_count[i] = 0;
+    }
+    b->candidates_count = 0;
+    // Initialize all the bitboards as empty
+    for (int p = 0; p < 2; ++p) {
+        for (int i = 0; i < BOARD_MAX_SIZE; ++i) {
+            b->rows[p][i] = 0;
+            b->cols[p][i] = 0;
+        }
+        for (int i = 0; i < BOARD_MAX_DIAGONALS; ++i) {
+            b->diags[p][i] = 0;
+            b->anti_diags[p][i] = 0;
         }
     }
     // Initialize the last move with -1, which means no move has been made
     b->last_move = -1;
+    b->n_moves = 0;
+    for (int dir = 0; dir < BOARD_DIRECTIONS; ++dir) {
+        b->last_runs[dir] = 0;
+    }
+    b->winner = -1;
+    board_zobrist_init();
+    b->hash = start_player == 1 ? board_zobrist_side : 0;
 }
 
 // Free the memory allocated for the board
+// The board no longer owns any heap memory; this is kept so callers stay symmetric with board_init
 void board_free(Board *b) {
-    free(b->moves_available);
-    for (int i = 0; i < b->width; ++i) {
-        free(b->states[i]);
-    }
-    free(b->states);
+    (void)b;
 }
 
 // Copy the board
 void board_copy(Board *b, Board *b_copy) {
-    board_init(b_copy, b->current_player, b->width, b->height, b->n_in_row);
-    for (int i = 0; i < b->width; ++i) {
-        for (int j = 0; j < b->height; ++j) {
-            b_copy->states[i][j] = b->states[i][j];
-        }
-    }
-    for (int i = 0; i < b->width * b->height; ++i) {
-        b_copy->moves_available[i] = b->moves_available[i];
-    }
-    b_copy->moves_available_count = b->moves_available_count;
-    b_copy->last_move = b->last_move;
+    *b_copy = *b;
 }
 
 // Convert a move to a location on the board
@@ -76,150 +153,525 @@ void board_move_to_location(Board *b, int move, int *x, int *y) {
     *y = move / b->width;
 }
 
+// Return the state of a square: the player who owns it, or -1 if it is empty
+int board_get_state(Board *b, int x, int y) {
+    BoardLine bit = (BoardLine)1 << x;
+    if (b->rows[0][y] & bit) {
+        return 0;
+    }
+    if (b->rows[1][y] & bit) {
+        return 1;
+    }
+    return -1;
+}
+
+// Return 1 if the move is on an empty square
+int board_is_empty(Board *b, int move) {
+    int x, y;
+    board_move_to_location(b, move, &x, &y);
+    return !((b->rows[0][y] | b->rows[1][y]) & ((BoardLine)1 << x));
+}
+
 // Convert a location on the board to a move
 void board_location_to_move(Board *b, int x, int y, int *move) {
-    *move = y * b->width + x;
     //if the move is invalid, return -1
     if (x < 0 || x >= b->width || y < 0 || y >= b->height) {
         *move = -1;
+        return;
     }
+    *move = y * b->width + x;
     //if the move is not available, return -1
-    if (b->moves_available[*move] == -1) {
+    if (!board_is_empty(b, *move)) {
         *move = -1;
     }
 }
 
+// Update last_runs and winner for the last move
+void board_update_runs(Board *b);
+
 // Place a piece on the board
 void board_do_move(Board *b, int move) {
     int x, y;
     board_move_to_location(b, move, &x, &y);
-    b->states[x][y] = b->current_player;
-    // Remove the move from the moves available
-    b->moves_available[move] = -1;
-    // Update moves_available_count
-    b->moves_available_count -= 1;
+    int p = b->current_player;
+    b->rows[p][y] |= (BoardLine)1 << x;
+    b->cols[p][x] |= (BoardLine)1 << y;
+    b->diags[p][x - y + b->height - 1] |= (BoardLine)1 << x;
+    b->anti_diags[p][x + y] |= (BoardLine)1 << x;
+    // Remove the move from the moves available by swapping the last one into its place
+    // moves_available_index[move] is left pointing at the freed slot so board_undo_move can restore it
+    int index = b->moves_available_index[move];
+    int last = b->moves_available[--b->moves_available_count];
+    b->moves_available[index] = last;
+    b->moves_available_index[last] = index;
+    b->moves_available[b->moves_available_count] = move;
+    // The move is no longer a candidate, and the empty squares around it become candidates
+    // Like moves_available, candidates_index[move] keeps the freed slot, and new candidates are
+    // appended so board_undo_move can take them off the end in reverse order
+    if (b->near_count[move] > 0) {
+        index = b->candidates_index[move];
+        last = b->candidates[--b->candidates_count];
+        b->candidates[index] = last;
+        b->candidates_index[last] = index;
+        b->candidates[b->candidates_count] = move;
+    }
+    int r = BOARD_CANDIDATE_RADIUS;
+    for (int ny = y - r > 0 ? y - r : 0; ny <= y + r && ny < b->height; ++ny) {
+        for (int nx = x - r > 0 ? x - r : 0; nx <= x + r && nx < b->width; ++nx) {
+            int near = ny * b->width + nx;
+            if (near != move && b->near_count[near]++ == 0 && board_is_empty(b, near)) {
+                b->candidates_index[near] = b->candidates_count;
+                b->candidates[b->candidates_count++] = near;
+            }
+        }
+    }
     // Update the player
     b->current_player = 1 - b->current_player;
     // Update the last move
     b->last_move = move;
+    b->moves[b->n_moves++] = move;
+    b->hash ^= board_zobrist[p][move] ^ board_zobrist_side;
+    board_update_runs(b);
 }
 
-//Check forbidden moves
-int board_check_forbidden(Board *b, int move) {
+// Take back the last move made on the board
+void board_undo_move(Board *b) {
+    int move = b->moves[--b->n_moves];
     int x, y;
     board_move_to_location(b, move, &x, &y);
-    // Check Overline Forbidden Move
-    int count = 1;
-    int i = 1;
-    while (x + i < b->width && b->states[x + i][y] == b->current_player) {
-        ++count;
-        ++i;
-    }
-    i = 1;
-    while (x - i >= 0 && b->states[x - i][y] == b->current_player) {
-        ++count;
-        ++i;
-    }
-    if (count >= b->n_in_row) {
+    // The player who made the move is the one to play again
+    b->current_player = 1 - b->current_player;
+    int p = b->current_player;
+    b->rows[p][y] &= ~((BoardLine)1 << x);
+    b->cols[p][x] &= ~((BoardLine)1 << y);
+    b->diags[p][x - y + b->height - 1] &= ~((BoardLine)1 << x);
+    b->anti_diags[p][x + y] &= ~((BoardLine)1 << x);
+    // Put the move back in its old slot and the swapped move back at the end
+    int index = b->moves_available_index[move];
+    int swapped = b->moves_available[index];
+    b->moves_available[b->moves_available_count] = swapped;
+    b->moves_available_index[swapped] = b->moves_available_count;
+    b->moves_available[index] = move;
+    b->moves_available_count += 1;
+    // Undo the candidate changes of board_do_move in reverse order
+    int r = BOARD_CANDIDATE_RADIUS;
+    for (int ny = (y + r < b->height ? y + r : b->height - 1); ny >= y - r && ny >= 0; --ny) {
+        for (int nx = (x + r < b->width ? x + r : b->width - 1); nx >= x - r && nx >= 0; --nx) {
+            int near = ny * b->width + nx;
+            if (near != move && --b->near_count[near] == 0 && board_is_empty(b, near)) {
+                b->candidates_count -= 1;
+            }
+        }
+    }
+    if (b->near_count[move] > 0) {
+        index = b->candidates_index[move];
+        swapped = b->candidates[index];
+        b->candidates[b->candidates_count] = swapped;
+        b->candidates_index[swapped] = b->candidates_count;
+        b->candidates[index] = move;
+        b->candidates_count += 1;
+    }
+    b->last_move = b->n_moves > 0 ? b->moves[b->n_moves - 1] : -1;
+    b->hash ^= board_zobrist[p][move] ^ board_zobrist_side;
+    // No move is made after a win, so the position before the move was decided only by its own last move
+    board_update_runs(b);
+}
+
+// Take back moves until only n_moves remain on the move stack
+void board_undo_moves(Board *b, int n_moves) {
+    while (b->n_moves > n_moves) {
+        board_undo_move(b);
+    }
+}
+
+// Return the length of the run of set bits in line that passes through bit pos
+int board_line_run_length(BoardLine line, int pos) {
+    if (!(line & ((BoardLine)1 << pos))) {
+        return 0;
+    }
+    // Count the set bits from pos upwards, then from pos downwards
+    uint64_t up = ~((uint64_t)line >> pos);
+    uint64_t down = ~((uint64_t)line << (63 - pos));
+    return __builtin_ctzll(up) + __builtin_clzll(down) - 1;
+}
+
+// Return 1 if line has n set bits in a row that include bit pos
+// r keeps bit i only if bits i .. i + n - 1 are all set, then r is masked
+// to the windows that start in [pos - n + 1, pos]
+int board_line_has_run(BoardLine line, int pos, int n) {
+    uint64_t r = line;
+    for (int i = 1; i < n; ++i) {
+        r &= (uint64_t)line >> i;
+    }
+    int low = pos - n + 1 > 0 ? pos - n + 1 : 0;
+    uint64_t window = (((uint64_t)1 << (pos - low + 1)) - 1) << low;
+    return (r & window) != 0;
+}
+
+// Return 1 if the stone of player at (x, y) is part of n_in_row in any direction
+int board_has_n_in_row(Board *b, int player, int x, int y) {
+    int n = b->n_in_row;
+    return board_line_has_run(b->rows[player][y], x, n)
+        || board_line_has_run(b->cols[player][x], y, n)
+        || board_line_has_run(b->diags[player][x - y + b->height - 1], x, n)
+        || board_line_has_run(b->anti_diags[player][x + y], x, n);
+}
+
+// Return the line of player through (x, y) in direction dir
+// pos is set to the bit of (x, y) in the line, and [lo, hi] to the bits that are on the board
+BoardLine board_get_line(Board *b, int player, int dir, int x, int y, int *pos, int *lo, int *hi) {
+    int d;
+    switch (dir) {
+        case 0:
+            *pos = x;
+            *lo = 0;
+            *hi = b->width - 1;
+            return b->rows[player][y];
+        case 1:
+            *pos = y;
+            *lo = 0;
+            *hi = b->height - 1;
+            return b->cols[player][x];
+        case 2:
+            // Along a diagonal y = x - d + height - 1
+            d = x - y + b->height - 1;
+            *pos = x;
+            *lo = d - b->height + 1 > 0 ? d - b->height + 1 : 0;
+            *hi = d < b->width - 1 ? d : b->width - 1;
+            return b->diags[player][d];
+        default:
+            // Along an anti-diagonal y = d - x
+            d = x + y;
+            *pos = x;
+            *lo = d - b->height + 1 > 0 ? d - b->height + 1 : 0;
+            *hi = d < b->width - 1 ? d : b->width - 1;
+            return b->anti_diags[player][d];
+    }
+}
+
+// Return the move at bit i of the line through (x, y) in direction dir
+int board_line_move(Board *b, int dir, int x, int y, int i) {
+    switch (dir) {
+        case 0:
+            return y * b->width + i;
+        case 1:
+            return i * b->width + x;
+        case 2:
+            return (i - x + y) * b->width + i;
+        default:
+            return (x + y - i) * b->width + i;
+    }
+}
+
+// Return 1 if player is held to the Renju restrictions on this board
+int board_is_restricted(Board *b, int player) {
+    return b->rule == BOARD_RULE_RENJU && player == b->black && b->n_in_row == 5;
+}
+
+// Return 1 if placing a stone of player on the empty square move makes n_in_row
+// Under Renju, black only wins with exactly five
+int board_is_winning_move(Board *b, int player, int move) {
+    int x, y, pos, lo, hi;
+    int is_exact = board_is_restricted(b, player);
+    board_move_to_location(b, move, &x, &y);
+    for (int dir = 0; dir < BOARD_DIRECTIONS; ++dir) {
+        BoardLine line = board_get_line(b, player, dir, x, y, &pos, &lo, &hi) | ((BoardLine)1 << pos);
+        if (is_exact ? board_line_run_length(line, pos) == b->n_in_row : board_line_has_run(line, pos, b->n_in_row)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Return 1 if placing a stone of player on the empty square move makes an open four:
+// a run of n_in_row - 1 stones with an empty square on the board at both ends
+int board_is_open_four_move(Board *b, int player, int move) {
+    int x, y, pos, lo, hi;
+    board_move_to_location(b, move, &x, &y);
+    for (int dir = 0; dir < BOARD_DIRECTIONS; ++dir) {
+        BoardLine own = board_get_line(b, player, dir, x, y, &pos, &lo, &hi) | ((BoardLine)1 << pos);
+        BoardLine occupied = own | board_get_line(b, 1 - player, dir, x, y, &pos, &lo, &hi);
+        uint64_t up = ~((uint64_t)own >> pos);
+        uint64_t down = ~((uint64_t)own << (63 - pos));
+        int start = pos - __builtin_clzll(down) + 1;
+        int end = pos + __builtin_ctzll(up) - 1;
+        if (end - start + 1 == b->n_in_row - 1 && start - 1 >= lo && end + 1 <= hi
+            && !(occupied & ((BoardLine)1 << (start - 1))) && !(occupied & ((BoardLine)1 << (end + 1)))) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Collect the empty squares within n_in_row - 1 of move along the four lines through it
+// moves must hold at least 8 * (n_in_row - 1) entries; return the number collected
+int board_get_line_neighbors(Board *b, int move, int *moves) {
+    int x, y, pos, lo, hi;
+    int count = 0;
+    int reach = b->n_in_row - 1;
+    board_move_to_location(b, move, &x, &y);
+    for (int dir = 0; dir < BOARD_DIRECTIONS; ++dir) {
+        BoardLine occupied = board_get_line(b, 0, dir, x, y, &pos, &lo, &hi)
+                             | board_get_line(b, 1, dir, x, y, &pos, &lo, &hi);
+        int from = pos - reach > lo ? pos - reach : lo;
+        int to = pos + reach < hi ? pos + reach : hi;
+        for (int i = from; i <= to; ++i) {
+            if (!(occupied & ((BoardLine)1 << i))) {
+                moves[count++] = board_line_move(b, dir, x, y, i);
+            }
+        }
+    }
+    return count;
+}
+
+// Renju patterns are looked up by the 11 squares of a line centred on the move: the move itself and
+// 5 squares either side. Each of the other 10 squares is a ternary digit, 0 for empty, 1 for one of
+// the player's stones and 2 for an opponent's stone or off the board.
+#define BOARD_PATTERN_RADIUS 5
+#define BOARD_PATTERN_COUNT 59049 // 3^10
+// The bits of a pattern, which describe the line once the move is played
+#define BOARD_PATTERN_FIVE 0x1 // Exactly five in a row through the move
+#define BOARD_PATTERN_OVERLINE 0x2 // Six or more in a row through the move
+#define BOARD_PATTERN_FOURS(pattern) (((pattern) >> 2) & 0x3) // The number of fours through the move, at most 2
+#define BOARD_PATTERN_THREE 0x10 // An open three through the move
+#define BOARD_PATTERN_KEYS(pattern) ((pattern) >> 5) // The squares that turn the three into an open four, one bit per square
+// The deepest a double three check follows the key squares of its threes to see whether they are forbidden
+#define BOARD_FORBIDDEN_MAX_DEPTH 3
+
+uint16_t board_patterns[BOARD_PATTERN_COUNT];
+uint16_t board_pattern_ternary[1 << (2 * BOARD_PATTERN_RADIUS)]; // The ternary value of a 10 bit mask
+int board_patterns_ready = 0;
+
+// Return the length of the run of stones through the centre of the 11 squares of a pattern
+int board_pattern_run(const int *cells) {
+    int length = 1;
+    for (int i = BOARD_PATTERN_RADIUS - 1; i >= 0 && cells[i] == 1; --i) {
+        length++;
+    }
+    for (int i = BOARD_PATTERN_RADIUS + 1; i <= 2 * BOARD_PATTERN_RADIUS && cells[i] == 1; ++i) {
+        length++;
+    }
+    return length;
+}
+
+// Collect the empty squares of a pattern that make exactly five through its centre, and return how many there are
+int board_pattern_five_squares(int *cells, int *squares) {
+    int count = 0;
+    for (int i = 0; i <= 2 * BOARD_PATTERN_RADIUS; ++i) {
+        if (cells[i] == 0) {
+            cells[i] = 1;
+            if (board_pattern_run(cells) == 5) {
+                squares[count++] = i;
+            }
+            cells[i] = 0;
+        }
+    }
+    return count;
+}
+
+// Return the number of fours through the centre of a pattern
+// The two ends of an open four make one four, so two five squares 5 apart count once
+int board_pattern_fours(int *cells) {
+    int squares[2 * BOARD_PATTERN_RADIUS + 1];
+    int count = board_pattern_five_squares(cells, squares);
+    if (count == 2 && squares[1] - squares[0] == 5) {
         return 1;
     }
-    // Check Double Three Forbidden Move
+    return count < 2 ? count : 2;
+}
 
+// Return 1 if the pattern holds an open four through its centre: two exact fives at either end
+int board_pattern_is_open_four(int *cells) {
+    int squares[2 * BOARD_PATTERN_RADIUS + 1];
+    int count = board_pattern_five_squares(cells, squares);
+    return count == 2 && squares[1] - squares[0] == 5;
 }
 
-//Check if the game is ended and return the winner
-void board_check_end(Board *b, int *is_end, int *winner) {
-    *is_end = 0;
-    *winner = -1;
-    // if the last move is -1, no move has been made
-    if (b->last_move == -1) {
+// Build the pattern of every encoding of the 10 squares around the move
+void board_patterns_init(void) {
+    if (board_patterns_ready) {
         return;
     }
-    // Check if the board is full
-    int is_full = 1;
-    for (int i = 0; i < b->width * b->height; ++i) {
-        if (b->moves_available[i] != -1) {
-            is_full = 0;
-            break;
+    for (int mask = 0; mask < (1 << (2 * BOARD_PATTERN_RADIUS)); ++mask) {
+        int value = 0;
+        for (int i = 2 * BOARD_PATTERN_RADIUS - 1; i >= 0; --i) {
+            value = value * 3 + ((mask >> i) & 1);
         }
+        board_pattern_ternary[mask] = (uint16_t)value;
     }
-    if (is_full) {
-        *is_end = 1;
-        *winner = -1;
-        return;
+    for (int index = 0; index < BOARD_PATTERN_COUNT; ++index) {
+        // Decode the squares, leaving the centre for the move
+        int cells[2 * BOARD_PATTERN_RADIUS + 1];
+        int digits = index;
+        for (int i = 0; i <= 2 * BOARD_PATTERN_RADIUS; ++i) {
+            if (i == BOARD_PATTERN_RADIUS) {
+                cells[i] = 1;
+                continue;
+            }
+            cells[i] = digits % 3;
+            digits /= 3;
+        }
+        int run = board_pattern_run(cells);
+        uint16_t pattern = 0;
+        if (run == 5) {
+            pattern = BOARD_PATTERN_FIVE;
+        } else if (run > 5) {
+            pattern = BOARD_PATTERN_OVERLINE;
+        } else {
+            int fours = board_pattern_fours(cells);
+            pattern = (uint16_t)(fours << 2);
+            if (fours == 0) {
+                // A three is a shape one move away from an open four, without making five or an overline
+                int keys = 0;
+                for (int i = 0; i <= 2 * BOARD_PATTERN_RADIUS; ++i) {
+                    if (cells[i] != 0) {
+                        continue;
+                    }
+                    cells[i] = 1;
+                    if (board_pattern_run(cells) < 5 && board_pattern_is_open_four(cells)) {
+                        keys |= 1 << (i < BOARD_PATTERN_RADIUS ? i : i - 1);
+                    }
+                    cells[i] = 0;
+                }
+                if (keys != 0) {
+                    pattern |= BOARD_PATTERN_THREE | (uint16_t)(keys << 5);
+                }
+            }
+        }
+        board_patterns[index] = pattern;
+    }
+    board_patterns_ready = 1;
+}
+
+// Set the rule set of the board, BOARD_RULE_FREESTYLE or BOARD_RULE_RENJU
+void board_set_rule(Board *b, int rule) {
+    b->rule = rule;
+    if (rule == BOARD_RULE_RENJU) {
+        board_patterns_init();
+    }
+}
+
+// Return the pattern of the line through (x, y) in direction dir if player moved there
+int board_get_pattern(Board *b, int player, int dir, int x, int y) {
+    int pos, lo, hi;
+    BoardLine own = board_get_line(b, player, dir, x, y, &pos, &lo, &hi);
+    BoardLine opp = board_get_line(b, 1 - player, dir, x, y, &pos, &lo, &hi);
+    // Shift the 11 squares centred on pos down to bits 0 to 10, squares off either end of the line are blocked
+    uint64_t off_board = ~((((uint64_t)1 << (hi + 1)) - 1) & ~(((uint64_t)1 << lo) - 1));
+    uint64_t window = (((uint64_t)1 << (2 * BOARD_PATTERN_RADIUS + 1)) - 1);
+    uint64_t own_bits = (((uint64_t)own << BOARD_PATTERN_RADIUS) >> pos) & window;
+    uint64_t blocked_bits = ((((uint64_t)opp | off_board) << BOARD_PATTERN_RADIUS) >> pos) & window;
+    if (pos < BOARD_PATTERN_RADIUS) {
+        blocked_bits |= ((uint64_t)1 << (BOARD_PATTERN_RADIUS - pos)) - 1;
     }
-    // Check if there is a winner
+    // Drop the centre bit
+    uint64_t low = ((uint64_t)1 << BOARD_PATTERN_RADIUS) - 1;
+    own_bits = (own_bits & low) | ((own_bits >> (BOARD_PATTERN_RADIUS + 1)) << BOARD_PATTERN_RADIUS);
+    blocked_bits = (blocked_bits & low) | ((blocked_bits >> (BOARD_PATTERN_RADIUS + 1)) << BOARD_PATTERN_RADIUS);
+    return board_patterns[board_pattern_ternary[own_bits] + 2 * board_pattern_ternary[blocked_bits]];
+}
+
+// Add or remove a stone of player at (x, y) in the line views only, for looking ahead without a full move
+void board_toggle_stone(Board *b, int player, int x, int y) {
+    b->rows[player][y] ^= (BoardLine)1 << x;
+    b->cols[player][x] ^= (BoardLine)1 << y;
+    b->diags[player][x - y + b->height - 1] ^= (BoardLine)1 << x;
+    b->anti_diags[player][x + y] ^= (BoardLine)1 << x;
+}
+
+// Return 1 if the empty square move is forbidden for player under Renju, looking depth levels into double threes
+// A five is never forbidden. An overline or two fours are. Two threes are forbidden only if both are
+// real: a three is real if one of its key squares could be played to make an open four, which means the
+// key square must not be forbidden itself
+int board_is_forbidden_at_depth(Board *b, int player, int move, int depth) {
     int x, y;
-    board_move_to_location(b, b->last_move, &x, &y);
-    int player = b->states[x][y];
-    // Check horizontal
-    int count = 1;
-    int i = 1;
-    while (x + i < b->width && b->states[x + i][y] == player) {
-        ++count;
-        ++i;
-    }
-    i = 1;
-    while (x - i >= 0 && b->states[x - i][y] == player) {
-        ++count;
-        ++i;
-    }
-    if (count >= b->n_in_row) {
-        *is_end = 1;
-        *winner = player;
-        return;
+    board_move_to_location(b, move, &x, &y);
+    int patterns[BOARD_DIRECTIONS];
+    int fours = 0, threes = 0, is_overline = 0;
+    for (int dir = 0; dir < BOARD_DIRECTIONS; ++dir) {
+        patterns[dir] = board_get_pattern(b, player, dir, x, y);
+        if (patterns[dir] & BOARD_PATTERN_FIVE) {
+            return 0;
+        }
+        is_overline |= (patterns[dir] & BOARD_PATTERN_OVERLINE) != 0;
+        fours += BOARD_PATTERN_FOURS(patterns[dir]);
+        threes += (patterns[dir] & BOARD_PATTERN_THREE) != 0;
     }
-    // Check vertical
-    count = 1;
-    i = 1;
-    while (y + i < b->height && b->states[x][y + i] == player) {
-        ++count;
-        ++i;
-    }
-    i = 1;
-    while (y - i >= 0 && b->states[x][y - i] == player) {
-        ++count;
-        ++i;
-    }
-    if (count >= b->n_in_row) {
-        *is_end = 1;
-        *winner = player;
-        return;
+    if (is_overline || fours >= 2) {
+        return 1;
     }
-    // Check diagonal
-    count = 1;
-    i = 1;
-    while (x + i < b->width && y + i < b->height && b->states[x + i][y + i] == player) {
-        ++count;
-        ++i;
-    }
-    i = 1;
-    while (x - i >= 0 && y - i >= 0 && b->states[x - i][y - i] == player) {
-        ++count;
-        ++i;
-    }
-    if (count >= b->n_in_row) {
-        *is_end = 1;
-        *winner = player;
-        return;
+    if (threes < 2) {
+        return 0;
+    }
+    if (depth >= BOARD_FORBIDDEN_MAX_DEPTH) {
+        return 1;
+    }
+    // Look at the key squares with the move on the board
+    int real_threes = 0;
+    board_toggle_stone(b, player, x, y);
+    for (int dir = 0; dir < BOARD_DIRECTIONS && real_threes < 2; ++dir) {
+        if (!(patterns[dir] & BOARD_PATTERN_THREE)) {
+            continue;
+        }
+        int pos, lo, hi;
+        board_get_line(b, player, dir, x, y, &pos, &lo, &hi);
+        int keys = BOARD_PATTERN_KEYS(patterns[dir]);
+        for (int k = 0; k < 2 * BOARD_PATTERN_RADIUS; ++k) {
+            if (!(keys & (1 << k))) {
+                continue;
+            }
+            int i = pos + (k < BOARD_PATTERN_RADIUS ? k : k + 1) - BOARD_PATTERN_RADIUS;
+            if (!board_is_forbidden_at_depth(b, player, board_line_move(b, dir, x, y, i), depth + 1)) {
+                real_threes++;
+                break;
+            }
+        }
     }
-    // Check anti-diagonal
-    count = 1;
-    i = 1;
-    while (x + i < b->width && y - i >= 0 && b->states[x + i][y - i] == player) {
-        ++count;
-        ++i;
-    }
-    i = 1;
-    while (x - i >= 0 && y + i < b->height && b->states[x - i][y + i] == player) {
-        ++count;
-        ++i;
-    }
-    if (count >= b->n_in_row) {
-        *is_end = 1;
-        *winner = player;
+    board_toggle_stone(b, player, x, y);
+    return real_threes >= 2;
+}
+
+// Return 1 if the empty square move is forbidden for player
+// Only black under Renju has forbidden moves
+int board_is_forbidden_move(Board *b, int player, int move) {
+    return board_is_restricted(b, player) && board_is_forbidden_at_depth(b, player, move, 0);
+}
+
+//Check forbidden moves
+// Return 1 if the empty square move is forbidden for the player to move
+int board_check_forbidden(Board *b, int move) {
+    return board_is_forbidden_move(b, b->current_player, move);
+}
+
+void board_update_runs(Board *b) {
+    b->winner = -1;
+    if (b->last_move == -1) {
+        for (int dir = 0; dir < BOARD_DIRECTIONS; ++dir) {
+            b->last_runs[dir] = 0;
+        }
         return;
     }
+    int x, y;
+    board_move_to_location(b, b->last_move, &x, &y);
+    int p = board_get_state(b, x, y);
+    b->last_runs[0] = board_line_run_length(b->rows[p][y], x);
+    b->last_runs[1] = board_line_run_length(b->cols[p][x], y);
+    b->last_runs[2] = board_line_run_length(b->diags[p][x - y + b->height - 1], x);
+    b->last_runs[3] = board_line_run_length(b->anti_diags[p][x + y], x);
+    // Under Renju, black only wins with exactly five
+    int is_exact = board_is_restricted(b, p);
+    for (int dir = 0; dir < BOARD_DIRECTIONS; ++dir) {
+        if (is_exact ? b->last_runs[dir] == b->n_in_row : b->last_runs[dir] >= b->n_in_row) {
+            b->winner = p;
+        }
+    }
+}
+
+//Check if the game is ended and return the winner
+// The winner and the number of empty squares are kept up to date by every move, so this is O(1)
+void board_check_end(Board *b, int *is_end, int *winner) {
+    *winner = b->winner;
+    *is_end = b->winner != -1 || b->moves_available_count == 0;
 }
 
 //Draw the board and show game info
@@ -233,9 +685,10 @@ void board_draw_board(Board *b, int player1, int player2) {
     printf("\n");
     for (int i = 0; i < b->height; ++i) {
         for (int j = 0; j < b->width; ++j) {
-            if (b->states[j][i] == -1) {
+            int state = board_get_state(b, j, i);
+            if (state == -1) {
                 printf(". ");
-            } else if (b->states[j][i] == player1) {
+            } else if (state == player1) {
                 printf("X ");
             } else {
                 printf("O ");
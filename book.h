@@ -0,0 +1,172 @@
+//
+// Created by diex on 10/17/2026.
+//
+
+#ifndef GOMOKU_MCTS_C_BOOK_H
+#define GOMOKU_MCTS_C_BOOK_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "board.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// The opening book file
+// A BookHeader followed by n_entries BookEntry structs sorted by hash, in the byte order of the machine
+// that built it. A position may have several entries, which are kept in order of preference, so the
+// first legal one is the move to play. The file is mapped into memory and searched in place, so
+// opening a book costs the same however large it is, and a lookup reads only the pages it touches.
+
+#define BOOK_MAGIC 0x4B424D47 // "GMBK"
+#define BOOK_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int32_t width, height, n_in_row, rule; // The games the book was built for
+    uint64_t n_entries;
+} BookHeader;
+
+typedef struct {
+    uint64_t hash; // The Zobrist hash of the position, as in Board
+    uint16_t move;
+    int16_t value; // The mean value of the move for the player to move, times BOOK_VALUE_SCALE
+    uint32_t visits; // The visits the move got in the builder's search
+} BookEntry;
+
+#define BOOK_VALUE_SCALE 10000
+
+// Define the Book struct, an opening book mapped into memory
+typedef struct {
+    const BookHeader *header;
+    const BookEntry *entries;
+    uint64_t n_entries;
+    void *map;
+    size_t map_size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+} Book;
+
+void book_close(Book *book) {
+    if (book->map == NULL) {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(book->map);
+    CloseHandle(book->mapping);
+    CloseHandle(book->file);
+#else
+    munmap(book->map, book->map_size);
+#endif
+    book->map = NULL;
+}
+
+// Map the book at path into memory, return 1 on success
+int book_open(Book *book, const char *path) {
+    book->map = NULL;
+#ifdef _WIN32
+    book->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (book->file == INVALID_HANDLE_VALUE) {
+        printf("Cannot open the opening book %s.\n", path);
+        return 0;
+    }
+    LARGE_INTEGER size;
+    GetFileSizeEx(book->file, &size);
+    book->map_size = (size_t)size.QuadPart;
+    book->mapping = CreateFileMappingA(book->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (book->mapping != NULL) {
+        book->map = MapViewOfFile(book->mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+    if (book->map == NULL) {
+        if (book->mapping != NULL) {
+            CloseHandle(book->mapping);
+        }
+        CloseHandle(book->file);
+        printf("Cannot map the opening book %s.\n", path);
+        return 0;
+    }
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("Cannot open the opening book %s.\n", path);
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(BookHeader)) {
+        close(fd);
+        printf("%s is not an opening book.\n", path);
+        return 0;
+    }
+    book->map_size = (size_t)st.st_size;
+    void *map = mmap(NULL, book->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file open
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("Cannot map the opening book %s.\n", path);
+        return 0;
+    }
+    book->map = map;
+#endif
+    book->header = (const BookHeader*)book->map;
+    book->entries = (const BookEntry*)(book->header + 1);
+    book->n_entries = book->header->n_entries;
+    if (book->map_size < sizeof(BookHeader) || book->header->magic != BOOK_MAGIC
+        || book->header->version != BOOK_VERSION
+        || book->n_entries > (book->map_size - sizeof(BookHeader)) / sizeof(BookEntry)) {
+        printf("%s is not an opening book this version can read.\n", path);
+        book_close(book);
+        return 0;
+    }
+    return 1;
+}
+
+// Return the first of the entries of the position with the given hash, and their number in count
+// Return NULL if the book does not have the position
+const BookEntry *book_find(const Book *book, uint64_t hash, int *count) {
+    uint64_t low = 0, high = book->n_entries;
+    while (low < high) {
+        uint64_t mid = low + (high - low) / 2;
+        if (book->entries[mid].hash < hash) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    uint64_t end = low;
+    while (end < book->n_entries && book->entries[end].hash == hash) {
+        end++;
+    }
+    *count = (int)(end - low);
+    return *count > 0 ? &book->entries[low] : NULL;
+}
+
+// Look up the book move for b, return 0 if the book does not have the position
+// Every move is checked to be legal, as a hash can collide with a position of another game
+int book_lookup(const Book *book, Board *b, int *move) {
+    const BookHeader *header = book->header;
+    if (header->width != b->width || header->height != b->height || header->n_in_row != b->n_in_row
+        || header->rule != b->rule) {
+        return 0;
+    }
+    int count;
+    const BookEntry *entries = book_find(book, b->hash, &count);
+    for (int i = 0; i < count; ++i) {
+        int m = entries[i].move;
+        if (m < b->width * b->height && board_is_empty(b, m) && !board_check_forbidden(b, m)) {
+            *move = m;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+#endif //GOMOKU_MCTS_C_BOOK_H
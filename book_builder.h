@@ -0,0 +1,208 @@
+//
+// Created by diex on 10/17/2026.
+//
+
+#ifndef GOMOKU_MCTS_C_BOOK_BUILDER_H
+#define GOMOKU_MCTS_C_BOOK_BUILDER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "book.h"
+#include "mcts.h"
+
+// The most moves kept for each position of the book
+#define BOOK_MAX_MOVES 8
+
+// The entries of one position, kept together until the book is written
+typedef struct {
+    uint64_t hash;
+    int first; // The index of the position's first entry
+    int count;
+} BookPosition;
+
+// Define the BookBuilder struct, which searches the early positions and writes the book
+typedef struct {
+    MCTS mcts;
+    BookEntry *entries;
+    int n_entries;
+    int entries_capacity;
+    BookPosition *positions;
+    int n_positions;
+    int positions_capacity;
+} BookBuilder;
+
+void book_builder_init(BookBuilder *builder, int c_puct, int n_playout, int n_threads) {
+    mcts_init(&builder->mcts, c_puct, n_playout);
+    mcts_set_threads(&builder->mcts, n_threads);
+    builder->entries = NULL;
+    builder->n_entries = 0;
+    builder->entries_capacity = 0;
+    builder->positions = NULL;
+    builder->n_positions = 0;
+    builder->positions_capacity = 0;
+}
+
+void book_builder_free(BookBuilder *builder) {
+    mcts_free(&builder->mcts);
+    free(builder->entries);
+    free(builder->positions);
+}
+
+// Return 1 if the position has been searched already, as it can be reached by several move orders
+int book_builder_has_position(BookBuilder *builder, uint64_t hash) {
+    for (int i = 0; i < builder->n_positions; ++i) {
+        if (builder->positions[i].hash == hash) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void book_builder_add_entry(BookBuilder *builder, uint64_t hash, int move, int visits, double value) {
+    if (builder->n_entries == builder->entries_capacity) {
+        builder->entries_capacity = builder->entries_capacity > 0 ? 2 * builder->entries_capacity : 256;
+        builder->entries = (BookEntry*)realloc(builder->entries, builder->entries_capacity * sizeof(BookEntry));
+        if (builder->entries == NULL) {
+            printf("Out of memory building the opening book.\n");
+            exit(1);
+        }
+    }
+    BookEntry *entry = &builder->entries[builder->n_entries++];
+    entry->hash = hash;
+    entry->move = (uint16_t)move;
+    entry->value = (int16_t)(value * BOOK_VALUE_SCALE);
+    entry->visits = (uint32_t)visits;
+}
+
+// Search b, add its best moves to the book, and go on below the branching best of them until depth
+void book_builder_search(BookBuilder *builder, Board *b, int depth, int branching) {
+    int is_end, winner;
+    board_check_end(b, &is_end, &winner);
+    if (is_end || book_builder_has_position(builder, b->hash)) {
+        return;
+    }
+    // Every position gets a search of its own
+    mcts_update_with_move(&builder->mcts, -1);
+    int action;
+    mcts_get_action(&builder->mcts, b, &action);
+
+    // Merge the root statistics of all trees
+    int visits[BOARD_MAX_CELLS] = {0};
+    double value_sums[BOARD_MAX_CELLS] = {0};
+    for (int t = 0; t <= builder->mcts.n_helpers; ++t) {
+        TreeNode *root = t == 0 ? builder->mcts.root : builder->mcts.helpers[t - 1].root;
+        for (int i = 0; i < root->n_children; ++i) {
+            visits[root->actions[i]] += root->edge_visits[i];
+            value_sums[root->actions[i]] += root->edge_value_sums[i];
+        }
+    }
+
+    // The move the search chose comes first, then the others in order of visits
+    int moves[BOOK_MAX_MOVES];
+    int n_moves = 0;
+    moves[n_moves++] = action;
+    while (n_moves < BOOK_MAX_MOVES) {
+        int best = -1;
+        for (int i = 0; i < b->moves_available_count; ++i) {
+            int move = b->moves_available[i];
+            int is_taken = 0;
+            for (int j = 0; j < n_moves; ++j) {
+                is_taken |= moves[j] == move;
+            }
+            if (!is_taken && visits[move] > 0 && (best == -1 || visits[move] > visits[best])) {
+                best = move;
+            }
+        }
+        if (best == -1) {
+            break;
+        }
+        moves[n_moves++] = best;
+    }
+
+    BookPosition *position;
+    if (builder->n_positions == builder->positions_capacity) {
+        builder->positions_capacity = builder->positions_capacity > 0 ? 2 * builder->positions_capacity : 64;
+        builder->positions = (BookPosition*)realloc(builder->positions,
+                                                    builder->positions_capacity * sizeof(BookPosition));
+        if (builder->positions == NULL) {
+            printf("Out of memory building the opening book.\n");
+            exit(1);
+        }
+    }
+    position = &builder->positions[builder->n_positions++];
+    position->hash = b->hash;
+    position->first = builder->n_entries;
+    position->count = n_moves;
+    for (int i = 0; i < n_moves; ++i) {
+        int move = moves[i];
+        book_builder_add_entry(builder, b->hash, move, visits[move],
+                               visits[move] > 0 ? value_sums[move] / visits[move] : 0);
+    }
+
+    if (depth <= 1) {
+        return;
+    }
+    for (int i = 0; i < n_moves && i < branching; ++i) {
+        board_do_move(b, moves[i]);
+        book_builder_search(builder, b, depth - 1, branching);
+        board_undo_move(b);
+    }
+}
+
+int book_compare_positions(const void *a, const void *b) {
+    uint64_t hash_a = ((const BookPosition*)a)->hash;
+    uint64_t hash_b = ((const BookPosition*)b)->hash;
+    return hash_a < hash_b ? -1 : hash_a > hash_b;
+}
+
+// Write the book to path, sorted by hash, return 1 on success
+int book_builder_write(BookBuilder *builder, Board *b, const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        printf("Cannot open %s to write the opening book.\n", path);
+        return 0;
+    }
+    BookHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = BOOK_MAGIC;
+    header.version = BOOK_VERSION;
+    header.width = b->width;
+    header.height = b->height;
+    header.n_in_row = b->n_in_row;
+    header.rule = b->rule;
+    header.n_entries = builder->n_entries;
+    // Positions are sorted whole, so the entries of each keep their order of preference
+    qsort(builder->positions, builder->n_positions, sizeof(BookPosition), book_compare_positions);
+    int is_ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    for (int i = 0; i < builder->n_positions && is_ok; ++i) {
+        BookPosition *position = &builder->positions[i];
+        is_ok = fwrite(&builder->entries[position->first], sizeof(BookEntry), position->count, f)
+                == (size_t)position->count;
+    }
+    if (fclose(f) != 0) {
+        is_ok = 0;
+    }
+    if (!is_ok) {
+        printf("Writing the opening book %s failed.\n", path);
+    }
+    return is_ok;
+}
+
+// Build an opening book for games on b, which must be empty, and write it to path
+// Every position reached by playing one of the branching best moves of each side, up to depth moves
+// deep, is searched with n_playout playouts; return 1 on success
+int book_build(Board *b, const char *path, int depth, int branching, int c_puct, int n_playout, int n_threads) {
+    BookBuilder builder;
+    book_builder_init(&builder, c_puct, n_playout, n_threads);
+    uint64_t start_ns = timer_now_ns();
+    book_builder_search(&builder, b, depth, branching);
+    int is_ok = book_builder_write(&builder, b, path);
+    if (is_ok) {
+        printf("Opening book: %d positions, %d moves in %.1f s, written to %s.\n", builder.n_positions,
+               builder.n_entries, (double)(timer_now_ns() - start_ns) / 1e9, path);
+    }
+    book_builder_free(&builder);
+    return is_ok;
+}
+
+#endif //GOMOKU_MCTS_C_BOOK_BUILDER_H
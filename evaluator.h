@@ -0,0 +1,43 @@
+//
+// Created by diex on 10/17/2026.
+//
+
+#ifndef GOMOKU_MCTS_C_EVALUATOR_H
+#define GOMOKU_MCTS_C_EVALUATOR_H
+
+#include <stdint.h>
+#include "board.h"
+
+// The evaluation of one leaf position
+typedef struct {
+    int actions[BOARD_MAX_CELLS]; // The moves the leaf is expanded with
+    double priors[BOARD_MAX_CELLS]; // The prior probability of each move, summing to 1
+    int actions_count;
+    double value; // From the perspective of the player to move: 1 is a win, -1 a loss
+    int weight; // The number of evaluations value is the mean of, it counts as that many visits
+    int rollout_moves; // The moves played by rollouts to find value, for the search stats; 0 without rollouts
+    int n_round_limit; // The rollouts among them stopped by the round limit
+} EvaluatorResult;
+
+// Fill results[i] with the priors and the value of boards[i], for each of the n_boards leaves
+// The boards belong to the caller and may be changed, so a rollout can be played on them
+// rng is the random number generator of the calling thread
+// In tree parallel mode several threads call it at once, so it must be thread safe
+typedef void (*EvaluateFunction)(void *data, Board **boards, int n_boards, EvaluatorResult *results, uint64_t *rng);
+
+// Define the Evaluator struct
+// The search gathers up to batch_size leaves, holding them apart with virtual loss, and hands them
+// to evaluate in one call, so a costly evaluator pays its per call overhead once per batch
+typedef struct {
+    EvaluateFunction evaluate;
+    void *data; // Passed to evaluate, such as the weights of a network
+    int batch_size; // The most leaves evaluated in one call
+} Evaluator;
+
+void evaluator_init(Evaluator *evaluator, EvaluateFunction evaluate, void *data, int batch_size) {
+    evaluator->evaluate = evaluate;
+    evaluator->data = data;
+    evaluator->batch_size = batch_size < 1 ? 1 : batch_size;
+}
+
+#endif //GOMOKU_MCTS_C_EVALUATOR_H
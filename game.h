@@ -10,6 +10,9 @@
 
 #include "board.h"
 #include "mcts_player.h"
+#include "nn.h"
+#include "record.h"
+#include "timer.h"
 
 // Get player actions
 void game_get_action(Board *b, int *move) {
@@ -18,9 +21,13 @@ void game_get_action(Board *b, int *move) {
     int x, y;
     scanf("%d %d", &x, &y);
     board_location_to_move(b, x, y, move);
-    // If the move is invalid, ask for another move
-    while (*move == -1) {
-        printf("Invalid move. Enter your move (format: x y): ");
+    // If the move is invalid or forbidden, ask for another move
+    while (*move == -1 || board_check_forbidden(b, *move)) {
+        if (*move == -1) {
+            printf("Invalid move. Enter your move (format: x y): ");
+        } else {
+            printf("Forbidden move. Enter your move (format: x y): ");
+        }
         scanf("%d %d", &x, &y);
         board_location_to_move(b, x, y, move);
     }
@@ -45,9 +52,10 @@ void game_draw_board(Board *b, int player1, int player2) {
 
     for (int i = 0; i < b->height; ++i) {
         for (int j = 0; j < b->width; ++j) {
-            if (b->states[j][i] == -1) {
+            int state = board_get_state(b, j, i);
+            if (state == -1) {
                 printf("%-*s ", maxDigits, ".");
-            } else if (b->states[j][i] == player1) {
+            } else if (state == player1) {
                 printf("%-*s ", maxDigits, "X");
             } else {
                 printf("%-*s ", maxDigits, "O");
@@ -92,14 +100,26 @@ void game_start_human(Board *b, int start_player, int is_show_board) {
 }
 
 // start a game between a human and an MCTS player
-void game_start_human_vs_mcts(Board *b, int start_player, int is_show_board, int c_puct, int n_playout) {
+// With is_ponder set, the MCTS player keeps searching while the human thinks
+// book gives the MCTS player's opening moves, NULL for none
+// stats_output receives the search stats of each of the MCTS player's moves, NULL for none
+// nn scores the MCTS player's leaves with a network, NULL for rollouts
+void game_start_human_vs_mcts(Board *b, int start_player, int is_show_board, int c_puct, int n_playout, int n_threads,
+                              int is_ponder, const Book *book, FILE *stats_output, NNEvaluator *nn) {
     int player1, player2;
     player1 = 0;
     player2 = 1;
 
 
     MCTSPlayer mcts_player;
-    mcts_player_init(&mcts_player, c_puct, n_playout);
+    mcts_player_init(&mcts_player, c_puct, n_playout, n_threads);
+    mcts_player_set_book(&mcts_player, book);
+    if (stats_output != NULL) {
+        mcts_player_set_stats_output(&mcts_player, stats_output);
+    }
+    if (nn != NULL) {
+        mcts_player_set_evaluator(&mcts_player, nn_evaluate, nn, NN_DEFAULT_BATCH_SIZE);
+    }
 
     if (is_show_board) {
         game_draw_board(b, player1, player2);
@@ -108,7 +128,11 @@ void game_start_human_vs_mcts(Board *b, int start_player, int is_show_board, int
     while (1) {
         int move;
         if (b->current_player == player1) {
+            if (is_ponder) {
+                mcts_player_start_ponder(&mcts_player, b);
+            }
             game_get_action(b, &move);
+            mcts_player_update_with_move(&mcts_player, move);
         } else {
             mcts_player_get_action(&mcts_player, b, &move);
         }
@@ -130,5 +154,149 @@ void game_start_human_vs_mcts(Board *b, int start_player, int is_show_board, int
     mcts_player_free(&mcts_player);
 }
 
-#endif //GOMOKU_MCTS_C_GAME_H
+// The settings of a self-play run
+typedef struct {
+    int width, height, n_in_row, rule;
+    int n_games; // The number of games to play
+    int n_workers; // The number of games played at once, each on its own thread
+    int c_puct;
+    int n_playout; // The playouts of each move's search
+    int n_sampled_moves; // The opening moves chosen at random in proportion to the visits, so games differ
+    const char *path; // The record file the games are appended to
+    FILE *stats_output; // Receives the search stats of every move, NULL for none
+    NNEvaluator *nn; // Scores the leaves of every search with a network, NULL for rollouts
+    uint64_t seed; // Every game is seeded from this and its index, so a run can be repeated
+} SelfPlayConfig;
+
+// The state shared by the threads of a self-play run
+typedef struct {
+    SelfPlayConfig *config;
+    RecordWriter *writer;
+    int next_game; // The index of the next game to be claimed by a worker
+    long n_moves; // The moves played by all workers
+    int n_wins[3]; // Games won by player 0, by player 1, and ties
+} SelfPlayState;
+
+// Play one self-play game between two MCTS players and record every position
+void game_play_self_play(SelfPlayConfig *config, int start_player, GameRecord *record, uint64_t *rng) {
+    Board b;
+    board_init(&b, start_player, config->width, config->height, config->n_in_row);
+    board_set_rule(&b, config->rule);
+    game_record_start(record, &b);
+    // Each player keeps its own tree, so both are told about every move
+    MCTSPlayer players[2];
+    for (int i = 0; i < 2; ++i) {
+        uint64_t seed = (uint64_t)mcts_random(rng) << 32 | mcts_random(rng);
+        mcts_player_init_seeded(&players[i], config->c_puct, config->n_playout, 1, seed);
+        if (config->stats_output != NULL) {
+            mcts_player_set_stats_output(&players[i], config->stats_output);
+        }
+        if (config->nn != NULL) {
+            mcts_player_set_evaluator(&players[i], nn_evaluate, config->nn, NN_DEFAULT_BATCH_SIZE);
+        }
+    }
+    int visits[BOARD_MAX_CELLS];
+    while (1) {
+        int move;
+        mcts_player_get_action_with_visits(&players[b.current_player], &b, &move, visits);
+        if (b.n_moves < config->n_sampled_moves) {
+            long total = 0;
+            for (int i = 0; i < b.width * b.height; ++i) {
+                total += visits[i];
+            }
+            if (total > 0) {
+                long r = (long)(((uint64_t)mcts_random(rng) << 32 | mcts_random(rng)) % (uint64_t)total);
+                for (int i = 0; i < b.width * b.height; ++i) {
+                    r -= visits[i];
+                    if (r < 0) {
+                        move = i;
+                        break;
+                    }
+                }
+            }
+        }
+        // A move played without visits, such as one proven before the search, is counted once
+        if (visits[move] == 0) {
+            visits[move] = 1;
+        }
+        game_record_add_position(record, move, visits);
+        mcts_player_update_with_move(&players[0], move);
+        mcts_player_update_with_move(&players[1], move);
+        board_do_move(&b, move);
+        int is_end = 0, winner = -1;
+        board_check_end(&b, &is_end, &winner);
+        if (is_end) {
+            record->winner = winner;
+            break;
+        }
+    }
+    for (int i = 0; i < 2; ++i) {
+        mcts_player_free(&players[i]);
+    }
+    board_free(&b);
+}
 
+// Derive the seed of game number game of a self-play run from the run's seed with splitmix64
+uint64_t game_self_play_seed(uint64_t seed, int game) {
+    uint64_t z = seed + (uint64_t)(game + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    // xorshift needs a non-zero state
+    return (z ^ (z >> 31)) | 1;
+}
+
+void *game_self_play_thread(void *arg) {
+    SelfPlayState *state = (SelfPlayState*)arg;
+    GameRecord record;
+    game_record_init(&record);
+    while (1) {
+        int game = __atomic_fetch_add(&state->next_game, 1, __ATOMIC_RELAXED);
+        if (game >= state->config->n_games) {
+            break;
+        }
+        // Games are claimed in no fixed order, so each is seeded from its index rather than its worker's
+        uint64_t rng = game_self_play_seed(state->config->seed, game);
+        // The players take turns to move first
+        game_play_self_play(state->config, game % 2, &record, &rng);
+        record_writer_add_game(state->writer, &record);
+        __atomic_fetch_add(&state->n_moves, record.n_moves, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&state->n_wins[record.winner + 1], 1, __ATOMIC_RELAXED);
+    }
+    game_record_free(&record);
+    return NULL;
+}
+
+// Play config->n_games games between MCTS players on config->n_workers threads, appending them to config->path
+// Every position is recorded with the root visits of its search, and every game with its winner
+// Return 1 if all games were written
+int game_start_self_play(SelfPlayConfig *config) {
+    RecordWriter writer;
+    if (!record_writer_open(&writer, config->path)) {
+        return 0;
+    }
+    SelfPlayState state;
+    state.config = config;
+    state.writer = &writer;
+    state.next_game = 0;
+    state.n_moves = 0;
+    state.n_wins[0] = state.n_wins[1] = state.n_wins[2] = 0;
+    int n_workers = config->n_workers < 1 ? 1 : config->n_workers;
+    uint64_t start_ns = timer_now_ns();
+    pthread_t *threads = (pthread_t*)malloc(n_workers * sizeof(pthread_t));
+    for (int i = 1; i < n_workers; ++i) {
+        pthread_create(&threads[i], NULL, game_self_play_thread, &state);
+    }
+    game_self_play_thread(&state);
+    for (int i = 1; i < n_workers; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    int is_ok = record_writer_close(&writer);
+    double seconds = (double)(timer_now_ns() - start_ns) / 1e9;
+    printf("Self-play: %d games, %ld moves in %.1f s (%.1f moves/s), %ld bytes written to %s.\n", config->n_games,
+           state.n_moves, seconds, state.n_moves / seconds, writer.n_bytes, config->path);
+    printf("Player 0 won %d, player 1 won %d, %d ties.\n", state.n_wins[1], state.n_wins[2], state.n_wins[0]);
+    return is_ok;
+}
+
+#endif //GOMOKU_MCTS_C_GAME_H
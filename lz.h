@@ -0,0 +1,154 @@
+//
+// Created by diex on 10/17/2026.
+//
+
+#ifndef GOMOKU_MCTS_C_LZ_H
+#define GOMOKU_MCTS_C_LZ_H
+
+#include <stdint.h>
+#include <string.h>
+
+// A small LZ77 block compressor, fast enough to keep up with the writer of a record file
+// A block is a list of sequences. Each starts with a token byte, whose high 4 bits are the number of
+// literals and whose low 4 bits are the match length minus LZ_MIN_MATCH, with 15 meaning that more
+// length bytes follow (each adds up to 255). The literals come next, then the 16 bit little endian
+// offset of the match back from the current position. The last sequence has literals only.
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+
+// Write the remainder of a length that did not fit in its 4 bits of the token
+int lz_write_length(uint8_t *dst, int capacity, int *out, int length) {
+    while (length >= 255) {
+        if (*out >= capacity) {
+            return 0;
+        }
+        dst[(*out)++] = 255;
+        length -= 255;
+    }
+    if (*out >= capacity) {
+        return 0;
+    }
+    dst[(*out)++] = (uint8_t)length;
+    return 1;
+}
+
+// Write one sequence of n_literals literals, then a match of match_length bytes at offset back
+// match_length 0 ends the block; return 0 if dst is too small
+int lz_write_sequence(uint8_t *dst, int capacity, int *out, const uint8_t *literals, int n_literals, int offset,
+                      int match_length) {
+    int match_code = match_length > 0 ? match_length - LZ_MIN_MATCH : 0;
+    if (*out >= capacity) {
+        return 0;
+    }
+    dst[(*out)++] = (uint8_t)((n_literals < 15 ? n_literals : 15) << 4 | (match_code < 15 ? match_code : 15));
+    if (n_literals >= 15 && !lz_write_length(dst, capacity, out, n_literals - 15)) {
+        return 0;
+    }
+    if (*out + n_literals > capacity) {
+        return 0;
+    }
+    memcpy(dst + *out, literals, n_literals);
+    *out += n_literals;
+    if (match_length == 0) {
+        return 1;
+    }
+    if (*out + 2 > capacity) {
+        return 0;
+    }
+    dst[(*out)++] = (uint8_t)(offset & 0xFF);
+    dst[(*out)++] = (uint8_t)(offset >> 8);
+    return match_code < 15 || lz_write_length(dst, capacity, out, match_code - 15);
+}
+
+// Compress the n bytes at src into dst, which holds capacity bytes
+// Return the compressed size, or 0 if it would not fit, in which case the block is better stored as it is
+// Matches are found through a hash table of the last position of every 4 byte sequence
+int lz_compress(const uint8_t *src, int n, uint8_t *dst, int capacity) {
+    int table[1 << LZ_HASH_BITS];
+    for (int i = 0; i < (1 << LZ_HASH_BITS); ++i) {
+        table[i] = -1;
+    }
+    int out = 0, anchor = 0, i = 0;
+    while (i + LZ_MIN_MATCH <= n) {
+        uint32_t sequence;
+        memcpy(&sequence, src + i, sizeof(sequence));
+        uint32_t h = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+        int candidate = table[h];
+        table[h] = i;
+        if (candidate < 0 || i - candidate > LZ_MAX_OFFSET || memcmp(src + candidate, src + i, LZ_MIN_MATCH) != 0) {
+            i++;
+            continue;
+        }
+        int length = LZ_MIN_MATCH;
+        while (i + length < n && src[candidate + length] == src[i + length]) {
+            length++;
+        }
+        if (!lz_write_sequence(dst, capacity, &out, src + anchor, i - anchor, i - candidate, length)) {
+            return 0;
+        }
+        i += length;
+        anchor = i;
+    }
+    if (!lz_write_sequence(dst, capacity, &out, src + anchor, n - anchor, 0, 0)) {
+        return 0;
+    }
+    return out;
+}
+
+// Read the remainder of a length whose 4 bits in the token were all set
+int lz_read_length(const uint8_t *src, int n, int *in, int *length) {
+    uint8_t byte;
+    do {
+        if (*in >= n) {
+            return 0;
+        }
+        byte = src[(*in)++];
+        *length += byte;
+    } while (byte == 255);
+    return 1;
+}
+
+// Decompress the n bytes at src into dst, which holds capacity bytes
+// Return the decompressed size, or -1 if the block is corrupt
+int lz_decompress(const uint8_t *src, int n, uint8_t *dst, int capacity) {
+    int in = 0, out = 0;
+    while (in < n) {
+        int token = src[in++];
+        int n_literals = token >> 4;
+        if (n_literals == 15 && !lz_read_length(src, n, &in, &n_literals)) {
+            return -1;
+        }
+        if (in + n_literals > n || out + n_literals > capacity) {
+            return -1;
+        }
+        memcpy(dst + out, src + in, n_literals);
+        in += n_literals;
+        out += n_literals;
+        if (in == n) {
+            break;
+        }
+        if (in + 2 > n) {
+            return -1;
+        }
+        int offset = src[in] | src[in + 1] << 8;
+        in += 2;
+        int length = token & 15;
+        if (length == 15 && !lz_read_length(src, n, &in, &length)) {
+            return -1;
+        }
+        length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > out || out + length > capacity) {
+            return -1;
+        }
+        // The match may overlap the bytes it produces, so copy one byte at a time
+        for (int i = 0; i < length; ++i) {
+            dst[out + i] = dst[out - offset + i];
+        }
+        out += length;
+    }
+    return out;
+}
+
+#endif //GOMOKU_MCTS_C_LZ_H
@@ -1,14 +1,218 @@
+// clock_gettime, CLOCK_MONOTONIC and MAP_ANONYMOUS are POSIX, hidden by a strict -std=c11 unless asked for
+// before the first system header
+#define _DEFAULT_SOURCE
+#include <string.h>
 #include "game.h"
+#include "book_builder.h"
 
-int main() {
+// Load the network in the weight file path into net and evaluator, with int8 convolutions if is_int8 is set
+// Return 1 on success
+int main_load_network(const char *path, int is_int8, NeuralNet *net, NNEvaluator *evaluator) {
+    if (!nn_load(net, path)) {
+        return 0;
+    }
+    if (is_int8) {
+        nn_quantize(net);
+    }
+    nn_evaluator_init(evaluator, net);
+    return 1;
+}
+
+// Run self-play with the settings given on the command line
+// Usage: selfplay [--out path] [--games n] [--workers n] [--playout n] [--size n] [--n-in-row n] [--sampled n] [--renju]
+//                 [--stats path] [--weights path] [--int8] [--seed n]
+//        selfplay --read-records path, to read a record file back and verify its games
+int main_self_play(int argc, char **argv) {
+    SelfPlayConfig config;
+    config.width = config.height = 9;
+    config.n_in_row = 5;
+    config.rule = BOARD_RULE_FREESTYLE;
+    config.n_games = 16;
+    config.n_workers = 4;
+    config.c_puct = 5;
+    config.n_playout = 1000;
+    config.n_sampled_moves = 6;
+    config.path = "selfplay.gmsp";
+    config.stats_output = NULL;
+    config.nn = NULL;
+    config.seed = (uint64_t)rand() << 32 | (uint64_t)rand();
+    const char *weights_path = NULL;
+    int is_int8 = 0;
+    for (int i = 2; i < argc; ++i) {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(argv[i], "--renju") == 0) {
+            config.rule = BOARD_RULE_RENJU;
+            continue;
+        }
+        if (strcmp(argv[i], "--int8") == 0) {
+            is_int8 = 1;
+            continue;
+        }
+        if (value == NULL) {
+            printf("Missing the value of %s.\n", argv[i]);
+            return 1;
+        }
+        if (strcmp(argv[i], "--out") == 0) {
+            config.path = value;
+        } else if (strcmp(argv[i], "--games") == 0) {
+            config.n_games = atoi(value);
+        } else if (strcmp(argv[i], "--workers") == 0) {
+            config.n_workers = atoi(value);
+        } else if (strcmp(argv[i], "--playout") == 0) {
+            config.n_playout = atoi(value);
+        } else if (strcmp(argv[i], "--size") == 0) {
+            config.width = config.height = atoi(value);
+        } else if (strcmp(argv[i], "--n-in-row") == 0) {
+            config.n_in_row = atoi(value);
+        } else if (strcmp(argv[i], "--sampled") == 0) {
+            config.n_sampled_moves = atoi(value);
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            config.stats_output = fopen(value, "a");
+            if (config.stats_output == NULL) {
+                printf("Cannot open %s for the search stats.\n", value);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--weights") == 0) {
+            weights_path = value;
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            config.seed = strtoull(value, NULL, 10);
+        } else if (strcmp(argv[i], "--read-records") == 0) {
+            return record_verify_file(value) ? 0 : 1;
+        } else {
+            printf("Unknown option %s.\n", argv[i]);
+            return 1;
+        }
+        i++;
+    }
+    if (config.width < config.n_in_row || config.width > BOARD_MAX_SIZE) {
+        printf("The board size must be between %d and %d.\n", config.n_in_row, BOARD_MAX_SIZE);
+        return 1;
+    }
+    NeuralNet net;
+    NNEvaluator evaluator;
+    if (weights_path != NULL) {
+        if (!main_load_network(weights_path, is_int8, &net, &evaluator)) {
+            return 1;
+        }
+        config.nn = &evaluator;
+    }
+    // The seed is printed so the run can be repeated with --seed
+    printf("Self-play seed: %llu\n", (unsigned long long)config.seed);
+    int is_ok = game_start_self_play(&config);
+    if (config.stats_output != NULL) {
+        fclose(config.stats_output);
+    }
+    if (config.nn != NULL) {
+        nn_evaluator_free(&evaluator);
+        nn_free(&net);
+    }
+    return is_ok ? 0 : 1;
+}
+
+// Build an opening book with the settings given on the command line
+// Usage: book [--out path] [--depth n] [--branching n] [--playout n] [--threads n] [--size n] [--n-in-row n] [--renju]
+int main_build_book(int argc, char **argv) {
+    const char *path = "book.gmbk";
+    int size = 9, n_in_row = 5, rule = BOARD_RULE_FREESTYLE;
+    int depth = 4, branching = 3, n_playout = 100000, n_threads = 1, c_puct = 5;
+    for (int i = 2; i < argc; ++i) {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(argv[i], "--renju") == 0) {
+            rule = BOARD_RULE_RENJU;
+            continue;
+        }
+        if (value == NULL) {
+            printf("Missing the value of %s.\n", argv[i]);
+            return 1;
+        }
+        if (strcmp(argv[i], "--out") == 0) {
+            path = value;
+        } else if (strcmp(argv[i], "--depth") == 0) {
+            depth = atoi(value);
+        } else if (strcmp(argv[i], "--branching") == 0) {
+            branching = atoi(value);
+        } else if (strcmp(argv[i], "--playout") == 0) {
+            n_playout = atoi(value);
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            n_threads = atoi(value);
+        } else if (strcmp(argv[i], "--size") == 0) {
+            size = atoi(value);
+        } else if (strcmp(argv[i], "--n-in-row") == 0) {
+            n_in_row = atoi(value);
+        } else {
+            printf("Unknown option %s.\n", argv[i]);
+            return 1;
+        }
+        i++;
+    }
+    if (size < n_in_row || size > BOARD_MAX_SIZE) {
+        printf("The board size must be between %d and %d.\n", n_in_row, BOARD_MAX_SIZE);
+        return 1;
+    }
+    Board b;
+    board_init(&b, 1, size, size, n_in_row);
+    board_set_rule(&b, rule);
+    int is_ok = book_build(&b, path, depth, branching, c_puct, n_playout, n_threads);
+    board_free(&b);
+    return is_ok ? 0 : 1;
+}
+
+// Usage: [selfplay ... | book ... | [--book path] [--stats path] [--weights path] [--int8]]
+int main(int argc, char **argv) {
     srand((unsigned)time(NULL));
+    if (argc > 1 && strcmp(argv[1], "selfplay") == 0) {
+        return main_self_play(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "book") == 0) {
+        return main_build_book(argc, argv);
+    }
+    // The MCTS player answers from an opening book given with --book, writes search stats to --stats,
+    // and scores its leaves with the network in --weights instead of rollouts
+    Book book;
+    int has_book = 0;
+    FILE *stats_output = NULL;
+    const char *weights_path = NULL;
+    int is_int8 = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--int8") == 0) {
+            is_int8 = 1;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            break;
+        }
+        if (strcmp(argv[i], "--book") == 0) {
+            has_book = book_open(&book, argv[i + 1]);
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats_output = fopen(argv[i + 1], "a");
+        } else if (strcmp(argv[i], "--weights") == 0) {
+            weights_path = argv[i + 1];
+        }
+        i++;
+    }
+    NeuralNet net;
+    NNEvaluator evaluator;
+    int has_network = weights_path != NULL && main_load_network(weights_path, is_int8, &net, &evaluator);
     Board gameBoard;
     int width = 9, height = 9, n_in_row = 5;
     int start_player = 1;
+    int rule = BOARD_RULE_FREESTYLE;
     board_init(&gameBoard, start_player, width, height, n_in_row);
+    board_set_rule(&gameBoard, rule);
     // game_start_human(&gameBoard, start_player, 1);
-    int c_puct = 5, n_playout = 10000;
-    game_start_human_vs_mcts(&gameBoard, start_player, 1, c_puct, n_playout);
+    int c_puct = 5, n_playout = 10000, n_threads = 1, is_ponder = 1;
+    game_start_human_vs_mcts(&gameBoard, start_player, 1, c_puct, n_playout, n_threads, is_ponder,
+                             has_book ? &book : NULL, stats_output, has_network ? &evaluator : NULL);
     board_free(&gameBoard);
+    if (has_book) {
+        book_close(&book);
+    }
+    if (stats_output != NULL) {
+        fclose(stats_output);
+    }
+    if (has_network) {
+        nn_evaluator_free(&evaluator);
+        nn_free(&net);
+    }
     return 0;
 }
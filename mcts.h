@@ -9,183 +9,894 @@
 #include <stdlib.h>
 #include <math.h>
 #include <time.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "arena.h"
 #include "board.h"
+#include "timer.h"
+#include "transposition.h"
+#include "threat.h"
+#include "evaluator.h"
+#include "book.h"
+#include "stats.h"
 #include "game.h"
 
 // Define the policy_value_function function that takes in a board state
 // and outputs a list of actions and the probabilities of taking these actions
-void policy_value_function(Board *b, int **actions, double **action_probs, int *actions_count) {
-    // Set actions to moves_available that is not -1 and initialize action_probs to 1 / moves_available_count
-    *actions_count = 0;
-    *action_probs = NULL;
-    *actions = NULL;
-
-    for (int i = 0; i < b->height * b->width; ++i) {
-        if (b->moves_available[i] != -1) {
-            // If this is an available move, add it to actions
-            // allocate memory for actions and action_probs if they are NULL
-            if (*actions == NULL) {
-                *actions = (int*)malloc(sizeof(int));
-                *action_probs = (double*)malloc(sizeof(double));
-            } else {
-                *actions = (int*)realloc(*actions, (*actions_count + 1) * sizeof(int));
-                *action_probs = (double*)realloc(*action_probs, (*actions_count + 1) * sizeof(double));
-            }
-            // Set actions and action_probs
-            (*actions)[*actions_count] = i;
-            (*action_probs)[*actions_count] = 1.0 / b->moves_available_count;
-            (*actions_count)++;
+// actions and action_probs must hold at least BOARD_MAX_CELLS entries
+// Only the candidate moves near a stone are returned, with probabilities in proportion to how
+// many stones are around them; on an empty board every move is equally likely
+// Moves forbidden to the player to move are left out
+void policy_value_function(Board *b, int *actions, double *action_probs, int *actions_count) {
+    int *moves = b->candidates;
+    int n_moves = b->candidates_count;
+    if (n_moves == 0) {
+        moves = b->moves_available;
+        n_moves = b->moves_available_count;
+    }
+    int is_restricted = board_is_restricted(b, b->current_player);
+    int count = 0;
+    for (int i = 0; i < n_moves; ++i) {
+        if (!is_restricted || !board_check_forbidden(b, moves[i])) {
+            actions[count++] = moves[i];
+        }
+    }
+    if (count == 0) {
+        // Every move is forbidden, so one has to be played anyway
+        for (int i = 0; i < n_moves; ++i) {
+            actions[count++] = moves[i];
+        }
+    }
+    *actions_count = count;
+    if (b->candidates_count == 0) {
+        // Initialize action_probs to 1 / count
+        for (int i = 0; i < count; ++i) {
+            action_probs[i] = 1.0 / count;
+        }
+        return;
+    }
+    int total = 0;
+    for (int i = 0; i < count; ++i) {
+        total += b->near_count[actions[i]];
+    }
+    for (int i = 0; i < count; ++i) {
+        action_probs[i] = (double)b->near_count[actions[i]] / total;
+    }
+}
+
+// Add move to the actions of policy_value_function if it is not among them, such as a winning move of
+// the threat solver far from the stones; it gets the highest prior, and the priors still sum to 1
+void mcts_add_action(int *actions, double *action_probs, int *actions_count, int move) {
+    double max_prob = 0;
+    for (int i = 0; i < *actions_count; ++i) {
+        if (actions[i] == move) {
+            return;
+        }
+        max_prob = action_probs[i] > max_prob ? action_probs[i] : max_prob;
+    }
+    double prob = *actions_count > 0 ? max_prob : 1.0;
+    actions[*actions_count] = move;
+    action_probs[*actions_count] = prob;
+    ++*actions_count;
+    for (int i = 0; i < *actions_count; ++i) {
+        action_probs[i] /= 1.0 + (*actions_count > 1 ? prob : 0.0);
+    }
+}
+
+// Return the next number from a xorshift64* generator
+// Each search keeps its own state, so searches on different threads do not share rand()
+uint32_t mcts_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return (uint32_t)((*state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+// The number of random moves a restricted rollout draws before it searches for a legal one
+#define MCTS_ROLLOUT_FORBIDDEN_TRIES 8
+
+// The rollout policy for a player bound by Renju: the same preferences as rollout_policy_function,
+// skipping forbidden moves
+int rollout_policy_restricted(Board *b, uint64_t *rng) {
+    int player = b->current_player;
+    int candidates[16 * BOARD_MAX_SIZE];
+    int count = 0;
+    if (b->n_moves >= 1) {
+        count += board_get_line_neighbors(b, b->moves[b->n_moves - 1], candidates + count);
+    }
+    if (b->n_moves >= 2) {
+        count += board_get_line_neighbors(b, b->moves[b->n_moves - 2], candidates + count);
+    }
+    for (int i = 0; i < count; ++i) {
+        if (board_is_winning_move(b, player, candidates[i])) {
+            return candidates[i];
+        }
+    }
+    for (int i = 0; i < count; ++i) {
+        if (board_is_winning_move(b, 1 - player, candidates[i]) && !board_check_forbidden(b, candidates[i])) {
+            return candidates[i];
+        }
+    }
+    for (int i = 0; i < count; ++i) {
+        if (board_is_open_four_move(b, player, candidates[i]) && !board_check_forbidden(b, candidates[i])) {
+            return candidates[i];
         }
     }
+    for (int i = 0; i < count; ++i) {
+        if (board_is_open_four_move(b, 1 - player, candidates[i]) && !board_check_forbidden(b, candidates[i])) {
+            return candidates[i];
+        }
+    }
+    for (int i = 0; i < MCTS_ROLLOUT_FORBIDDEN_TRIES; ++i) {
+        int move = b->moves_available[mcts_random(rng) % b->moves_available_count];
+        if (!board_check_forbidden(b, move)) {
+            return move;
+        }
+    }
+    int start = mcts_random(rng) % b->moves_available_count;
+    for (int i = 0; i < b->moves_available_count; ++i) {
+        int move = b->moves_available[(start + i) % b->moves_available_count];
+        if (!board_check_forbidden(b, move)) {
+            return move;
+        }
+    }
+    // Every move is forbidden, so one has to be played anyway
+    return b->moves_available[start];
 }
 
 // Define the rollout policy function that takes in a board state
-// and outputs a list of actions and the probabilities of taking these actions
-void rollout_policy_function(Board *b, int **actions, double **action_probs, int *actions_count) {
-    // Set actions to moves_available that is not -1 and initialize action_probs with random numbers
-    *actions_count = 0;
-    *action_probs = NULL;
-    *actions = NULL;
-
-    for (int i = 0; i < b->height * b->width; ++i) {
-        if (b->moves_available[i] != -1) {
-            // If this is an available move, add it to actions
-            // allocate memory for actions and action_probs if they are NULL
-            if (*actions == NULL) {
-                *actions = (int*)malloc(sizeof(int));
-                *action_probs = (double*)malloc(sizeof(double));
-            } else {
-                *actions = (int*)realloc(*actions, (*actions_count + 1) * sizeof(int));
-                *action_probs = (double*)realloc(*action_probs, (*actions_count + 1) * sizeof(double));
-            }
-            // Set actions and action_probs
-            (*actions)[*actions_count] = i;
-            (*action_probs)[*actions_count] = (double)rand() * (double)rand() / (double)RAND_MAX / (double)RAND_MAX;
-            (*actions_count)++;
+// and returns the action to play
+// Only the squares on the lines through the last two moves are examined, since every new threat
+// comes from one of them. In order of preference, it plays a winning move, blocks the opponent's
+// winning move, makes an open four, stops the opponent's open four, and otherwise plays a move
+// drawn uniformly from the moves available.
+// A player bound by Renju never plays a forbidden move; the pattern tables make the check cheap.
+int rollout_policy_function(Board *b, uint64_t *rng) {
+    int player = b->current_player;
+    if (board_is_restricted(b, player)) {
+        return rollout_policy_restricted(b, rng);
+    }
+    int candidates[16 * BOARD_MAX_SIZE];
+    int count = 0;
+    if (b->n_moves >= 1) {
+        count += board_get_line_neighbors(b, b->moves[b->n_moves - 1], candidates + count);
+    }
+    if (b->n_moves >= 2) {
+        count += board_get_line_neighbors(b, b->moves[b->n_moves - 2], candidates + count);
+    }
+    for (int i = 0; i < count; ++i) {
+        if (board_is_winning_move(b, player, candidates[i])) {
+            return candidates[i];
         }
     }
+    for (int i = 0; i < count; ++i) {
+        if (board_is_winning_move(b, 1 - player, candidates[i])) {
+            return candidates[i];
+        }
+    }
+    for (int i = 0; i < count; ++i) {
+        if (board_is_open_four_move(b, player, candidates[i])) {
+            return candidates[i];
+        }
+    }
+    for (int i = 0; i < count; ++i) {
+        if (board_is_open_four_move(b, 1 - player, candidates[i])) {
+            return candidates[i];
+        }
+    }
+    return b->moves_available[mcts_random(rng) % b->moves_available_count];
 }
 
+// Add v to the float at p atomically
+void mcts_atomic_add_float(float *p, float v) {
+    float expected, desired;
+    __atomic_load(p, &expected, __ATOMIC_RELAXED);
+    do {
+        desired = expected + v;
+    } while (!__atomic_compare_exchange(p, &expected, &desired, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+// Return the float at p, which other threads may be adding to with mcts_atomic_add_float
+float mcts_atomic_load_float(float *p) {
+    float value;
+    __atomic_load(p, &value, __ATOMIC_RELAXED);
+    return value;
+}
+
+// The expansion states of a node
+#define TREE_NODE_LEAF 0
+#define TREE_NODE_EXPANDING 1 // A thread is filling in the edges
+#define TREE_NODE_EXPANDED 2
+
+// The proven results of a node, from the perspective of its player to move
+#define TREE_NODE_UNPROVEN 0
+#define TREE_NODE_PROVEN_WIN 1
+#define TREE_NODE_PROVEN_LOSS -1
+
 // Define the nodes in the MCTS tree and its functions
+// Nodes live in the search's Arena. The edges to a node's children are stored as
+// parallel arrays, so selection reads a few contiguous arrays instead of chasing
+// a pointer per child. The statistics of an edge live in its parent.
+// Statistics are updated with atomics so several threads can search one tree;
+// selection reads them without locks and may see slightly stale values.
+// A node whose result is proven (MCTS-Solver) is no longer searched: a node is a proven
+// win if any child is a proven loss, and a proven loss if every child is a proven win.
 typedef struct treeNode {
     struct treeNode *parent;
-    struct treeNode **children;
-    int *actions;
-    int n_children;
+    int parent_edge; // The index of the edge from the parent to this node
+    int expand_state; // TREE_NODE_LEAF, TREE_NODE_EXPANDING or TREE_NODE_EXPANDED
+    int n_children; // The number of edges
     int n_visits;
-    double Q;
-    double u;
-    double p;
+    int proven; // TREE_NODE_UNPROVEN, TREE_NODE_PROVEN_WIN or TREE_NODE_PROVEN_LOSS
+    uint64_t hash; // The Zobrist hash of the node's position
+    int *actions; // The move of each edge
+    float *priors; // The prior probability P of each edge
+    int *edge_visits; // The visit count N of each edge
+    float *edge_value_sums; // The sum of leaf values W of each edge, from this node's player's perspective
+    int *edge_proven; // The proven result of each edge's child, from the child's player's perspective
+    struct treeNode **children; // The child node of each edge, NULL until the edge is first selected
 } TreeNode;
 
-void tree_node_init(TreeNode *node, TreeNode *parent, double p) {
+void tree_node_init(TreeNode *node, TreeNode *parent, int parent_edge) {
     node->parent = parent;
-    // mapping form actions to children
-    node->children = NULL;
-    node->actions = NULL;
+    node->parent_edge = parent_edge;
+    node->expand_state = TREE_NODE_LEAF;
     node->n_children = 0;
     node->n_visits = 0;
-    node->Q = 0;
-    node->u = 0;
-    node->p = p;
+    node->proven = TREE_NODE_UNPROVEN;
+    node->hash = 0;
+    node->actions = NULL;
+    node->priors = NULL;
+    node->edge_visits = NULL;
+    node->edge_value_sums = NULL;
+    node->edge_proven = NULL;
+    node->children = NULL;
 }
 
-void tree_node_free(TreeNode *node) {
-    for (int i = 0; i < node->n_children; ++i) {
-        tree_node_free(node->children[i]);
+// Return 1 if the node has been expanded and its edges can be read
+int tree_node_is_expanded(TreeNode *node) {
+    return __atomic_load_n(&node->expand_state, __ATOMIC_ACQUIRE) == TREE_NODE_EXPANDED;
+}
+
+// Allocate the edge arrays of a node with n edges as one block from the arena
+void tree_node_alloc_edges(TreeNode *node, Arena *arena, int n_edges) {
+    size_t n = (size_t)n_edges;
+    char *block = (char*)arena_alloc(arena, n * (sizeof(TreeNode*) + sizeof(int) + sizeof(float) + sizeof(int) + sizeof(float)
+                                                 + sizeof(int)));
+    node->children = (TreeNode**)block;
+    node->actions = (int*)(block + n * sizeof(TreeNode*));
+    node->priors = (float*)(node->actions + n);
+    node->edge_visits = (int*)(node->priors + n);
+    node->edge_value_sums = (float*)(node->edge_visits + n);
+    node->edge_proven = (int*)(node->edge_value_sums + n);
+}
+
+// An action and its prior probability, for sorting the edges of a node
+typedef struct {
+    int action;
+    double prior;
+} TreeNodeEdgeOrder;
+
+// Order edges by decreasing prior, then by action so the order does not depend on the input order
+int tree_node_compare_edges(const void *a, const void *b) {
+    const TreeNodeEdgeOrder *ea = (const TreeNodeEdgeOrder*)a;
+    const TreeNodeEdgeOrder *eb = (const TreeNodeEdgeOrder*)b;
+    if (ea->prior != eb->prior) {
+        return ea->prior > eb->prior ? -1 : 1;
     }
-    free(node->children);
-    free(node->actions);
+    return ea->action - eb->action;
+}
+
+// Claim a leaf node for expansion
+// Only the first thread to reach a leaf expands it; return 1 if this call claimed it
+// Until tree_node_expand publishes the edges, other playouts stop at the node and only evaluate it
+int tree_node_claim(TreeNode *node) {
+    int expected = TREE_NODE_LEAF;
+    return __atomic_compare_exchange_n(&node->expand_state, &expected, TREE_NODE_EXPANDING, 0,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
 }
 
-// Expand the tree by adding new children
-void tree_node_expand(TreeNode *node, int *actions, double *action_probs, int actions_count) {
+// Expand a leaf node claimed by tree_node_claim, adding an edge for every action
+// All the edge arrays are carved out of one arena allocation, child nodes are created lazily by tree_node_select
+// The edges are sorted by decreasing prior, so progressive widening opens the most likely moves first
+void tree_node_expand(TreeNode *node, Arena *arena, int *actions, double *action_probs, int actions_count) {
+    TreeNodeEdgeOrder order[BOARD_MAX_CELLS];
     for (int i = 0; i < actions_count; ++i) {
-        // if this action is not in the children, add it
-        int is_in_children = 0;
-        for (int j = 0; j < node->n_children; ++j) {
-            if (actions[i] == node->actions[j]) {
-                is_in_children = 1;
-                break;
-            }
+        order[i].action = actions[i];
+        order[i].prior = action_probs[i];
+    }
+    qsort(order, actions_count, sizeof(TreeNodeEdgeOrder), tree_node_compare_edges);
+    tree_node_alloc_edges(node, arena, actions_count);
+    for (int i = 0; i < actions_count; ++i) {
+        node->actions[i] = order[i].action;
+        node->priors[i] = (float)order[i].prior;
+        node->edge_visits[i] = 0;
+        node->edge_value_sums[i] = 0;
+        node->edge_proven[i] = TREE_NODE_UNPROVEN;
+        node->children[i] = NULL;
+    }
+    node->n_children = actions_count;
+    // Publish the edges to the threads reading expand_state
+    __atomic_store_n(&node->expand_state, TREE_NODE_EXPANDED, __ATOMIC_RELEASE);
+}
+
+// Return the arena bytes taken by the edges of a node with n_edges edges
+size_t tree_node_edges_size(int n_edges) {
+    return arena_round_size((size_t)n_edges * (sizeof(TreeNode*) + sizeof(int) + sizeof(float) + sizeof(int)
+                                               + sizeof(float) + sizeof(int)));
+}
+
+// Return 1 if a copy of node keeps its edges: the root of the copy always does, and other nodes need min_visits visits
+int tree_node_keeps_edges(TreeNode *node, TreeNode *parent, int min_visits) {
+    return node->n_children > 0 && (parent == NULL || node->n_visits >= min_visits);
+}
+
+// Return the arena bytes tree_node_copy would take to copy the subtree under node with min_visits
+size_t tree_node_copy_size(TreeNode *node, TreeNode *parent, int min_visits) {
+    size_t size = arena_round_size(sizeof(TreeNode));
+    if (!tree_node_keeps_edges(node, parent, min_visits)) {
+        return size;
+    }
+    size += tree_node_edges_size(node->n_children);
+    for (int i = 0; i < node->n_children; ++i) {
+        if (node->children[i] != NULL) {
+            size += tree_node_copy_size(node->children[i], node, min_visits);
         }
-        if (!is_in_children) {
-            node->n_children += 1;
-            node->children = (TreeNode**)realloc(node->children, node->n_children * sizeof(TreeNode*));
-            node->actions = (int*)realloc(node->actions, node->n_children * sizeof(int));
-            TreeNode *new_node = (TreeNode*)malloc(sizeof(TreeNode));
-            tree_node_init(new_node, node, action_probs[i]);
-            node->children[node->n_children - 1] = new_node;
-            node->actions[node->n_children - 1] = actions[i];
+    }
+    return size;
+}
+
+// Copy the subtree under node into arena and return the copy, whose parent is set to parent
+// A node below the copy's root with fewer than min_visits visits is copied as an unexpanded leaf, which
+// drops its subtree; its visits and value stay in its parent's edge, and it is expanded again if the
+// search comes back to it
+TreeNode *tree_node_copy(TreeNode *node, Arena *arena, TreeNode *parent, int min_visits) {
+    TreeNode *copy = (TreeNode*)arena_alloc(arena, sizeof(TreeNode));
+    *copy = *node;
+    copy->parent = parent;
+    if (!tree_node_keeps_edges(node, parent, min_visits)) {
+        if (node->n_children > 0) {
+            tree_node_init(copy, parent, node->parent_edge);
+            copy->n_visits = node->n_visits;
+            copy->proven = node->proven;
+            copy->hash = node->hash;
         }
+        return copy;
+    }
+    tree_node_alloc_edges(copy, arena, node->n_children);
+    for (int i = 0; i < node->n_children; ++i) {
+        copy->actions[i] = node->actions[i];
+        copy->priors[i] = node->priors[i];
+        copy->edge_visits[i] = node->edge_visits[i];
+        copy->edge_value_sums[i] = node->edge_value_sums[i];
+        copy->edge_proven[i] = node->edge_proven[i];
+        copy->children[i] = node->children[i] != NULL ? tree_node_copy(node->children[i], arena, copy, min_visits)
+                                                      : NULL;
     }
+    return copy;
 }
 
-// Calculate and return thw value for the current node
-// It is a combination of the action value Q, and this node's prior adjusted by its visit count, u
-// c_puct is a number in (0, inf) controlling the relative impact of values Q
-// and prior probability P on this node's score
-double tree_node_value(TreeNode *node, double c_puct) {
-    node->u = c_puct * node->p * sqrt(node->parent->n_visits) / (1 + node->n_visits);
-    return node->Q + node->u;
+// Progressive widening: a node with n_visits visits only offers its first
+// MCTS_WIDEN_BASE + MCTS_WIDEN_FACTOR * sqrt(n_visits) edges to selection
+#define MCTS_WIDEN_BASE 5
+#define MCTS_WIDEN_FACTOR 1.0
+
+// Functions that read the edge statistics with plain vector loads while other threads update them
+// C11 has no atomic vector loads, so these reads are racy by design and kept out of ThreadSanitizer's reports
+#if defined(__GNUC__)
+#define MCTS_RACY_READS __attribute__((no_sanitize_thread))
+#else
+#define MCTS_RACY_READS
+#endif
+
+// Score the first edges of a node with SIMD, as many as whole vectors cover up to n, and return how many
+// The best value and its edge are written to *max_value and *best, ties going to the lowest index
+// The statistics of an edge may be read in the middle of another thread's update, so its N and W can be
+// one playout apart; that only nudges the choice of an edge, as the stale reads of the scalar path do
+MCTS_RACY_READS
+int tree_node_best_edge_simd(TreeNode *node, int n, float k, float *max_value, int *best) {
+    int i = 0;
+#if defined(__AVX2__)
+    __m256 one = _mm256_set1_ps(1.0f);
+    __m256 vk = _mm256_set1_ps(k);
+    __m256 minus_infinity = _mm256_set1_ps(-INFINITY);
+    __m256 best_value = minus_infinity;
+    __m256i best_index = _mm256_setzero_si256();
+    __m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i step = _mm256_set1_epi32(8);
+    for (; i + 8 <= n; i += 8) {
+        __m256 visits = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)(node->edge_visits + i)));
+        __m256 q = _mm256_div_ps(_mm256_loadu_ps(node->edge_value_sums + i), _mm256_max_ps(visits, one));
+        __m256 u = _mm256_div_ps(_mm256_mul_ps(vk, _mm256_loadu_ps(node->priors + i)), _mm256_add_ps(one, visits));
+        __m256 value = _mm256_add_ps(q, u);
+        __m256i proven = _mm256_loadu_si256((const __m256i*)(node->edge_proven + i));
+        __m256 unproven = _mm256_castsi256_ps(_mm256_cmpeq_epi32(proven, _mm256_setzero_si256()));
+        value = _mm256_blendv_ps(minus_infinity, value, unproven);
+        __m256 greater = _mm256_cmp_ps(value, best_value, _CMP_GT_OQ);
+        best_value = _mm256_blendv_ps(best_value, value, greater);
+        best_index = _mm256_blendv_epi8(best_index, index, _mm256_castps_si256(greater));
+        index = _mm256_add_epi32(index, step);
+    }
+    float values[8];
+    int indices[8];
+    _mm256_storeu_ps(values, best_value);
+    _mm256_storeu_si256((__m256i*)indices, best_index);
+    for (int j = 0; j < 8; ++j) {
+        if (values[j] > *max_value || (values[j] == *max_value && indices[j] < *best)) {
+            *max_value = values[j];
+            *best = indices[j];
+        }
+    }
+#elif defined(__SSE2__)
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 vk = _mm_set1_ps(k);
+    __m128 minus_infinity = _mm_set1_ps(-INFINITY);
+    __m128 best_value = minus_infinity;
+    __m128i best_index = _mm_setzero_si128();
+    __m128i index = _mm_setr_epi32(0, 1, 2, 3);
+    __m128i step = _mm_set1_epi32(4);
+    for (; i + 4 <= n; i += 4) {
+        __m128 visits = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(node->edge_visits + i)));
+        __m128 q = _mm_div_ps(_mm_loadu_ps(node->edge_value_sums + i), _mm_max_ps(visits, one));
+        __m128 u = _mm_div_ps(_mm_mul_ps(vk, _mm_loadu_ps(node->priors + i)), _mm_add_ps(one, visits));
+        __m128 value = _mm_add_ps(q, u);
+        __m128 unproven = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(node->edge_proven + i)),
+                                                           _mm_setzero_si128()));
+        value = _mm_or_ps(_mm_and_ps(unproven, value), _mm_andnot_ps(unproven, minus_infinity));
+        __m128 greater = _mm_cmpgt_ps(value, best_value);
+        __m128i greater_i = _mm_castps_si128(greater);
+        best_value = _mm_or_ps(_mm_and_ps(greater, value), _mm_andnot_ps(greater, best_value));
+        best_index = _mm_or_si128(_mm_and_si128(greater_i, index), _mm_andnot_si128(greater_i, best_index));
+        index = _mm_add_epi32(index, step);
+    }
+    float values[4];
+    int indices[4];
+    _mm_storeu_ps(values, best_value);
+    _mm_storeu_si128((__m128i*)indices, best_index);
+    for (int j = 0; j < 4; ++j) {
+        if (values[j] > *max_value || (values[j] == *max_value && indices[j] < *best)) {
+            *max_value = values[j];
+            *best = indices[j];
+        }
+    }
+#else
+    (void)node;
+    (void)n;
+    (void)k;
+    (void)max_value;
+    (void)best;
+#endif
+    return i;
 }
 
-// Select the best child node that give maximum action value Q plus bonus u(P) and return the action and the child node
-void tree_node_select(TreeNode *node, double c_puct, int *action, TreeNode **child) {
-    double max_value = -1;
-    for (int i = 0; i < node->n_children; ++i) {
-        TreeNode *child_node = node->children[i];
-        double value = tree_node_value(child_node, c_puct);
+// Return the index of the edge with the maximum action value Q plus bonus u(P)
+// Q = W / N, and u = c_puct * P * sqrt(n_visits) / (1 + N), with sqrt(n_visits) computed once for the node
+// c_puct is a number in (0, inf) controlling the relative impact of values Q
+// and prior probability P on the edge's score
+// Only the edges opened by progressive widening are scored, and edges to proven children are skipped;
+// when every open edge is proven, the next unproven one is opened. Ties go to the edge with the lowest index
+// The statistics are read with relaxed atomics, as other threads may be updating them
+int tree_node_best_edge(TreeNode *node, double c_puct) {
+    double sqrt_visits = sqrt(__atomic_load_n(&node->n_visits, __ATOMIC_RELAXED));
+    int n_widened = MCTS_WIDEN_BASE + (int)(MCTS_WIDEN_FACTOR * sqrt_visits);
+    int n = n_widened < node->n_children ? n_widened : node->n_children;
+    float k = (float)(c_puct * sqrt_visits);
+    float max_value = -INFINITY;
+    int best = 0;
+    int i = tree_node_best_edge_simd(node, n, k, &max_value, &best);
+    // The remaining edges, or all of them without SIMD
+    for (; i < n; ++i) {
+        if (__atomic_load_n(&node->edge_proven[i], __ATOMIC_RELAXED) != TREE_NODE_UNPROVEN) {
+            continue;
+        }
+        float visits = (float)__atomic_load_n(&node->edge_visits[i], __ATOMIC_RELAXED);
+        float value = mcts_atomic_load_float(&node->edge_value_sums[i]) / (visits > 1.0f ? visits : 1.0f)
+                      + k * node->priors[i] / (1.0f + visits);
         if (value > max_value) {
             max_value = value;
-            *action = node->actions[i];
-            *child = child_node;
+            best = i;
         }
-        node->children[i] = child_node;
     }
+    if (max_value == -INFINITY) {
+        for (i = n; i < node->n_children; ++i) {
+            if (__atomic_load_n(&node->edge_proven[i], __ATOMIC_RELAXED) == TREE_NODE_UNPROVEN) {
+                return i;
+            }
+        }
+    }
+    return best;
+}
+
+// Select the best child node that give maximum action value Q plus bonus u(P) and return the action and the child node
+// The child node is created from the arena the first time its edge is selected, and is_new is then set
+// A virtual loss of virtual_loss lost visits is added to the edge so that other threads
+// searching the same tree are steered elsewhere until tree_node_update takes it back
+void tree_node_select(TreeNode *node, Arena *arena, double c_puct, int virtual_loss, int *action, TreeNode **child,
+                      int *is_new) {
+    *is_new = 0;
+    int edge = tree_node_best_edge(node, c_puct);
+    TreeNode *child_node = __atomic_load_n(&node->children[edge], __ATOMIC_ACQUIRE);
+    if (child_node == NULL) {
+        TreeNode *new_node = (TreeNode*)arena_alloc(arena, sizeof(TreeNode));
+        tree_node_init(new_node, node, edge);
+        // If another thread created the child first, use that one and leave ours in the arena
+        if (__atomic_compare_exchange_n(&node->children[edge], &child_node, new_node, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            child_node = new_node;
+            *is_new = 1;
+        }
+    }
+    if (virtual_loss != 0) {
+        __atomic_fetch_add(&node->edge_visits[edge], virtual_loss, __ATOMIC_RELAXED);
+        mcts_atomic_add_float(&node->edge_value_sums[edge], (float)-virtual_loss);
+        __atomic_fetch_add(&child_node->n_visits, virtual_loss, __ATOMIC_RELAXED);
+    }
+    *action = node->actions[edge];
+    *child = child_node;
 }
 
 // Update the current node from leaf evaluation
-// Leaf_value is the evaluation of the current board state from the perspective of the current player
-void tree_node_update(TreeNode *node, double leaf_value) {
-    node->n_visits += 1;
-    node->Q += (leaf_value - node->Q) / node->n_visits;
+// Leaf_value is the evaluation of the current board state from the perspective of the player who moved into it,
+// and it is added to the statistics of the edge from the parent
+// weight is the number of evaluations leaf_value is the mean of, and counts as that many visits
+// virtual_loss is the virtual loss tree_node_select applied on the way down, which is taken back here
+void tree_node_update(TreeNode *node, double leaf_value, int weight, int virtual_loss) {
+    if (node->parent == NULL) {
+        __atomic_fetch_add(&node->n_visits, weight, __ATOMIC_RELAXED);
+        return;
+    }
+    __atomic_fetch_add(&node->n_visits, weight - virtual_loss, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&node->parent->edge_visits[node->parent_edge], weight - virtual_loss, __ATOMIC_RELAXED);
+    mcts_atomic_add_float(&node->parent->edge_value_sums[node->parent_edge], (float)(weight * leaf_value + virtual_loss));
 }
 
 // Update the current node recursively
 // Just like tree_node_update, but applied recursively for all ancestors
-void tree_node_update_recursive(TreeNode *node, double leaf_value) {
+void tree_node_update_recursive(TreeNode *node, double leaf_value, int weight, int virtual_loss) {
     // If it is not the root node, this node's parent should be updated first
     if (node->parent != NULL) {
-        tree_node_update_recursive(node->parent, -leaf_value);
+        tree_node_update_recursive(node->parent, -leaf_value, weight, virtual_loss);
     }
-    tree_node_update(node, leaf_value);
+    tree_node_update(node, leaf_value, weight, virtual_loss);
 }
 
+// Record that the child along edge of node is proven, with proven from the child's player's perspective,
+// then prove node and its ancestors as far as that settles them
+void tree_node_prove_edge(TreeNode *node, int edge, int proven) {
+    while (node != NULL) {
+        __atomic_store_n(&node->edge_proven[edge], proven, __ATOMIC_RELAXED);
+        TreeNode *child = __atomic_load_n(&node->children[edge], __ATOMIC_ACQUIRE);
+        if (child != NULL) {
+            __atomic_store_n(&child->proven, proven, __ATOMIC_RELAXED);
+        }
+        // One losing reply is enough to win, but the node is lost only if every move loses
+        if (proven == TREE_NODE_PROVEN_LOSS) {
+            proven = TREE_NODE_PROVEN_WIN;
+        } else {
+            for (int i = 0; i < node->n_children; ++i) {
+                if (__atomic_load_n(&node->edge_proven[i], __ATOMIC_RELAXED) != TREE_NODE_PROVEN_WIN) {
+                    return;
+                }
+            }
+            proven = TREE_NODE_PROVEN_LOSS;
+        }
+        __atomic_store_n(&node->proven, proven, __ATOMIC_RELAXED);
+        edge = node->parent_edge;
+        node = node->parent;
+    }
+}
+
+// Record that node is proven, with proven from its player's perspective, and propagate it to its ancestors
+void tree_node_prove(TreeNode *node, int proven) {
+    __atomic_store_n(&node->proven, proven, __ATOMIC_RELAXED);
+    if (node->parent != NULL) {
+        tree_node_prove_edge(node->parent, node->parent_edge, proven);
+    }
+}
+
+// How several threads share the work of one search
+#define MCTS_PARALLEL_ROOT 0 // Every thread searches its own tree, the root visit counts are merged
+#define MCTS_PARALLEL_TREE 1 // All threads search one shared tree, kept apart by virtual loss
+
+// A pool of worker threads that run the rollouts of one leaf at the same time
+typedef struct {
+    int n_workers;
+    pthread_t *threads;
+    pthread_mutex_t lock; // Guards the fields of the current batch
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+    pthread_mutex_t submit_lock; // Lets only one batch run at a time
+    int capacity; // The most rollouts a batch can hold
+    Board *boards; // A copy of the leaf for every rollout of the batch
+    uint64_t *rngs;
+    double *values;
+    int *rollout_moves; // The moves each rollout played
+    int n_jobs; // The number of rollouts in the current batch
+    int next_job; // The next rollout to hand out
+    int n_done;
+    int stop;
+} RolloutPool;
+
+void rollout_pool_free(RolloutPool *pool);
+
+// The default evaluator, scoring leaves by rollouts
+void mcts_evaluate_rollouts(void *data, Board **boards, int n_boards, EvaluatorResult *results, uint64_t *rng);
+
 // Define the MCTS class and its functions
 typedef struct MCTS {
     TreeNode *root;
+    int root_n_moves; // The number of moves on the board at the root, -1 if the root has not been searched yet
+    Arena arena; // Owns every node of the tree
+    Arena spare_arena; // Receives the kept subtree when the root moves, then the two arenas swap
     double c_puct;
     int n_playout; // The number of simulations to run for each move
+    uint64_t rng; // State of the random number generator used by rollouts
+    int n_threads; // The number of threads searching for each move
+    int parallel_mode; // MCTS_PARALLEL_ROOT or MCTS_PARALLEL_TREE
+    int virtual_loss; // The number of lost visits added to an edge while a thread is below it in tree parallel mode
+    int n_helpers;
+    struct MCTS *helpers; // The independent trees searched by the other threads in root parallel mode
+    double time_budget_ms; // The wall-clock time a search may take, 0 for no limit
+    TranspositionTable *tt; // Shares statistics between transpositions within a search, NULL if disabled
+    int leaf_rollouts; // The number of rollouts that evaluate each leaf (leaf parallelism)
+    RolloutPool *rollout_pool; // Runs the rollouts of a leaf when leaf_rollouts > 1
+    int is_pondering; // 1 while ponder_thread is searching during the opponent's turn
+    int stop_ponder; // Set to ask ponder_thread to finish its current playout and return
+    pthread_t ponder_thread;
+    Board ponder_board; // The position ponder_thread searches from
+    int threat_depth; // The most attacker threats the solver at new leaves may play, 0 disables it
+    int threat_nodes; // The most positions the solver may visit at each leaf
+    int threat_vct; // 1 if the solver looks for wins by open threes as well as fours
+    Evaluator evaluator; // Gives the priors and the value of the leaves
+    const Book *book; // Moves played without searching, NULL if none
+    SearchStats stats; // The instrumentation of the current search, summed over its threads
+    FILE *stats_output; // Receives a JSON line of stats for every move, NULL if disabled
+    size_t memory_budget; // The bytes the trees of all threads may use together, 0 for no limit
+    size_t tree_budget; // This tree's share of the budget, split between its two arenas
+    int is_tree_full; // Set while the tree has no room to grow; playouts then stop at its frontier
 } MCTS;
 
-void mcts_init(MCTS *mcts, double c_puct, int n_playout) {
-    mcts->root = (TreeNode*)malloc(sizeof(TreeNode));
-    tree_node_init(mcts->root, NULL, 1.0);
+// Initialize mcts with its random number generator seeded from seed, so its searches can be repeated
+void mcts_init_seeded(MCTS *mcts, double c_puct, int n_playout, uint64_t seed) {
+    arena_init(&mcts->arena, ARENA_DEFAULT_SLAB_SIZE, 1);
+    arena_init(&mcts->spare_arena, ARENA_DEFAULT_SLAB_SIZE, 1);
+    mcts->root = (TreeNode*)arena_alloc(&mcts->arena, sizeof(TreeNode));
+    tree_node_init(mcts->root, NULL, -1);
+    mcts->root_n_moves = -1;
     mcts->c_puct = c_puct;
     mcts->n_playout = n_playout;
+    // xorshift needs a non-zero state
+    mcts->rng = seed | 1;
+    mcts->n_threads = 1;
+    mcts->parallel_mode = MCTS_PARALLEL_ROOT;
+    mcts->virtual_loss = 1;
+    mcts->n_helpers = 0;
+    mcts->helpers = NULL;
+    mcts->time_budget_ms = 0;
+    mcts->tt = NULL;
+    mcts->leaf_rollouts = 1;
+    mcts->rollout_pool = NULL;
+    mcts->is_pondering = 0;
+    mcts->stop_ponder = 0;
+    mcts->threat_depth = 10;
+    mcts->threat_nodes = 64;
+    mcts->threat_vct = 0;
+    evaluator_init(&mcts->evaluator, mcts_evaluate_rollouts, NULL, 1);
+    mcts->book = NULL;
+    search_stats_init(&mcts->stats, 0);
+    mcts->stats_output = NULL;
+    mcts->memory_budget = 0;
+    mcts->tree_budget = 0;
+    mcts->is_tree_full = 0;
+}
+
+// Initialize mcts with a seed drawn from rand()
+void mcts_init(MCTS *mcts, double c_puct, int n_playout) {
+    mcts_init_seeded(mcts, c_puct, n_playout, (uint64_t)rand() << 32 | (uint64_t)rand());
 }
 
+// Free the helper trees of a root parallel search
+void mcts_free_helpers(MCTS *mcts);
+
+// Stop pondering, if it is running
+void mcts_stop_ponder(MCTS *mcts);
+
 void mcts_free(MCTS *mcts) {
-    free(mcts->root);
+    mcts_stop_ponder(mcts);
+    mcts_free_helpers(mcts);
+    if (mcts->rollout_pool != NULL) {
+        rollout_pool_free(mcts->rollout_pool);
+        free(mcts->rollout_pool);
+        mcts->rollout_pool = NULL;
+    }
+    if (mcts->tt != NULL) {
+        tt_free(mcts->tt);
+        free(mcts->tt);
+        mcts->tt = NULL;
+    }
+    mcts->leaf_rollouts = 1;
+    mcts->n_threads = 1;
+    arena_free(&mcts->arena);
+    arena_free(&mcts->spare_arena);
+    mcts->root = NULL;
+}
+
+void mcts_free_helpers(MCTS *mcts) {
+    for (int i = 0; i < mcts->n_helpers; ++i) {
+        mcts_free(&mcts->helpers[i]);
+    }
+    free(mcts->helpers);
+    mcts->helpers = NULL;
+    mcts->n_helpers = 0;
+}
+
+// Return 1 if several threads search the tree of this MCTS at once
+int mcts_is_tree_parallel(MCTS *mcts) {
+    return mcts->n_threads > 1 && mcts->parallel_mode == MCTS_PARALLEL_TREE;
+}
+
+// Set the evaluator of the leaves
+void mcts_set_evaluator(MCTS *mcts, EvaluateFunction evaluate, void *data, int batch_size);
+
+// Under a memory budget the arenas are split into about this many slabs, so they grow in small steps
+#define MCTS_BUDGET_SLABS 16
+#define MCTS_MIN_SLAB_SIZE (64 * 1024)
+// The smallest budget a tree can search in: enough slabs in each arena for a batch of leaves with full edges
+// and for compaction to make room. Smaller budgets are raised to it
+#define MCTS_MIN_TREE_BUDGET (2 * 8 * MCTS_MIN_SLAB_SIZE)
+
+// Return the budget of each tree when memory_budget is shared between n_trees trees, at least MCTS_MIN_TREE_BUDGET
+size_t mcts_tree_budget_share(size_t memory_budget, int n_trees) {
+    size_t tree_budget = memory_budget / n_trees;
+    if (memory_budget > 0 && tree_budget < MCTS_MIN_TREE_BUDGET) {
+        printf("A memory budget of %zu bytes is too small for %d search trees; each tree gets %d bytes.\n",
+               memory_budget, n_trees, MCTS_MIN_TREE_BUDGET);
+        tree_budget = MCTS_MIN_TREE_BUDGET;
+    }
+    return tree_budget;
+}
+
+// Give the tree a budget of tree_budget bytes for its two arenas, 0 for no limit
+// The arenas are rebuilt to fit, with slabs small against the budget and no huge pages, which drops the tree
+void mcts_apply_tree_budget(MCTS *mcts, size_t tree_budget) {
+    size_t slab_size = ARENA_DEFAULT_SLAB_SIZE;
+    int use_hugepages = 1;
+    if (tree_budget > 0 && tree_budget < MCTS_MIN_TREE_BUDGET) {
+        tree_budget = MCTS_MIN_TREE_BUDGET;
+    }
+    if (tree_budget > 0) {
+        size_t slab_total = tree_budget / 2 / MCTS_BUDGET_SLABS;
+        slab_total = slab_total < MCTS_MIN_SLAB_SIZE ? MCTS_MIN_SLAB_SIZE
+                     : slab_total > ARENA_DEFAULT_SLAB_SIZE ? ARENA_DEFAULT_SLAB_SIZE : slab_total;
+        slab_size = slab_total - ARENA_SLAB_HEADER;
+        use_hugepages = 0;
+    }
+    int is_shared = mcts->arena.is_shared;
+    arena_free(&mcts->arena);
+    arena_free(&mcts->spare_arena);
+    arena_init(&mcts->arena, slab_size, use_hugepages);
+    arena_init(&mcts->spare_arena, slab_size, use_hugepages);
+    mcts->arena.is_shared = is_shared;
+    mcts->spare_arena.is_shared = is_shared;
+    mcts->tree_budget = tree_budget;
+    mcts->is_tree_full = 0;
+    mcts->root = (TreeNode*)arena_alloc(&mcts->arena, sizeof(TreeNode));
+    tree_node_init(mcts->root, NULL, -1);
+    mcts->root_n_moves = -1;
+}
+
+// Create the trees the threads need for the current thread count and parallel mode
+void mcts_setup_threads(MCTS *mcts) {
+    mcts_free_helpers(mcts);
+    if (mcts->n_threads > 1 && mcts->parallel_mode == MCTS_PARALLEL_ROOT) {
+        mcts->n_helpers = mcts->n_threads - 1;
+        mcts->helpers = (MCTS*)malloc(mcts->n_helpers * sizeof(MCTS));
+        for (int i = 0; i < mcts->n_helpers; ++i) {
+            // The helpers are seeded from this tree, so a seeded search stays repeatable
+            uint64_t seed = (uint64_t)mcts_random(&mcts->rng) << 32 | mcts_random(&mcts->rng);
+            mcts_init_seeded(&mcts->helpers[i], mcts->c_puct, mcts->n_playout, seed);
+            mcts->helpers[i].threat_depth = mcts->threat_depth;
+            mcts->helpers[i].threat_nodes = mcts->threat_nodes;
+            mcts->helpers[i].threat_vct = mcts->threat_vct;
+            mcts->helpers[i].stats.is_enabled = mcts->stats.is_enabled;
+            mcts_set_evaluator(&mcts->helpers[i], mcts->evaluator.evaluate, mcts->evaluator.data,
+                               mcts->evaluator.batch_size);
+        }
+    }
+    mcts->arena.is_shared = mcts_is_tree_parallel(mcts);
+    mcts->spare_arena.is_shared = mcts->arena.is_shared;
+    // The budget is shared out again between the new set of trees
+    if (mcts->memory_budget > 0) {
+        size_t tree_budget = mcts_tree_budget_share(mcts->memory_budget, mcts->n_helpers + 1);
+        for (int i = 0; i <= mcts->n_helpers; ++i) {
+            mcts_apply_tree_budget(i == 0 ? mcts : &mcts->helpers[i - 1], tree_budget);
+        }
+    }
 }
 
+// Set the number of threads used by mcts_get_action
+// Every thread gets its own board copy and random number generator, and in root
+// parallel mode its own tree as well
+void mcts_set_threads(MCTS *mcts, int n_threads) {
+    mcts->n_threads = n_threads < 1 ? 1 : n_threads;
+    mcts_setup_threads(mcts);
+}
+
+// Set how the threads share the search, MCTS_PARALLEL_ROOT or MCTS_PARALLEL_TREE
+void mcts_set_parallel_mode(MCTS *mcts, int parallel_mode) {
+    mcts->parallel_mode = parallel_mode;
+    mcts_setup_threads(mcts);
+}
+
+// Cap the memory of the search trees at memory_bytes, 0 for no limit
+// The budget is shared between the trees of a root parallel search, and each tree splits its share between
+// its arena and the spare arena the kept subtree is copied into. A tree searched by one thread that fills
+// its arena is compacted: the subtrees below nodes with few visits are dropped, their statistics staying
+// in their parents' edges, and their memory is reused. A tree shared by several threads instead stops
+// growing until the search ends. The tree is dropped, so set the budget before searching.
+// Each tree gets at least MCTS_MIN_TREE_BUDGET bytes; a budget too small for its trees is exceeded, with a warning.
+void mcts_set_memory_budget(MCTS *mcts, size_t memory_bytes) {
+    mcts_stop_ponder(mcts);
+    mcts->memory_budget = memory_bytes;
+    size_t tree_budget = mcts_tree_budget_share(memory_bytes, mcts->n_helpers + 1);
+    for (int i = 0; i <= mcts->n_helpers; ++i) {
+        mcts_apply_tree_budget(i == 0 ? mcts : &mcts->helpers[i - 1], tree_budget);
+    }
+}
+
+// Share statistics between positions reached by different move orders through a
+// transposition table of memory_bytes bytes, 0 disables it
+// The table is cleared when a search starts, so only playouts below the current root are shared
+void mcts_set_transposition_table(MCTS *mcts, size_t memory_bytes) {
+    if (mcts->tt != NULL) {
+        tt_free(mcts->tt);
+        free(mcts->tt);
+        mcts->tt = NULL;
+    }
+    if (memory_bytes > 0) {
+        mcts->tt = (TranspositionTable*)malloc(sizeof(TranspositionTable));
+        tt_init(mcts->tt, memory_bytes);
+    }
+}
+
+// Seed the edge into a newly created node with the playouts that reached its position by other move orders
+// The parent's visit count takes them too, so it stays the sum of its edges for PUCT; the ancestors above
+// are left as they are, since the playouts did not pass through them
+void mcts_tt_seed(MCTS *mcts, TreeNode *node) {
+    int visits;
+    float value_sum;
+    if (node->parent == NULL || !tt_probe(mcts->tt, node->hash, &visits, &value_sum)) {
+        return;
+    }
+    __atomic_fetch_add(&node->n_visits, visits, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&node->parent->n_visits, visits, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&node->parent->edge_visits[node->parent_edge], visits, __ATOMIC_RELAXED);
+    mcts_atomic_add_float(&node->parent->edge_value_sums[node->parent_edge], value_sum);
+}
+
+// Add one playout's visits and value to the position of every node on the path from node up to the root
+// Only real playouts reach the table, never the seeded visits, so no playout is counted twice in it
+// leaf_value is from the perspective of the player who moved into node, like tree_node_update
+void mcts_tt_add_path(MCTS *mcts, TreeNode *node, double leaf_value, int weight) {
+    for (; node->parent != NULL; node = node->parent) {
+        tt_add(mcts->tt, node->hash, weight, (float)(weight * leaf_value));
+        leaf_value = -leaf_value;
+    }
+}
+
+// The most moves a rollout plays before it is stopped and scored as a tie
+#define MCTS_ROUND_LIMIT 1000
+
 // Evaluate the leaf node by random rollout
 // Use the rollout policy to play until the end of the game
 // Get the winner and return from the perspective of the current player
 // Return 1 if the current player wins,
 // -1 if the opponent wins, and 0 if it is a tie
-double mcts_rollout(Board *b, int round_limit) {
+double mcts_rollout(Board *b, int round_limit, uint64_t *rng) {
     int is_end, winner;
     int player = b->current_player;
 
@@ -195,21 +906,8 @@ double mcts_rollout(Board *b, int round_limit) {
             break;
         }
 
-        // Get actions and action_probs from the rollout policy
-        int *actions = NULL;
-        double *action_probs = NULL;
-        int actions_count;
-        rollout_policy_function(b, &actions, &action_probs, &actions_count);
-
-        // Choose an action with the highest probability
-        int action;
-        double max_prob = -1;
-        for (int j = 0; j < actions_count; ++j) {
-            if (action_probs[j] > max_prob) {
-                max_prob = action_probs[j];
-                action = actions[j];
-            }
-        }
+        // Get the action from the rollout policy
+        int action = rollout_policy_function(b, rng);
 
         board_do_move(b, action);
         if (i == round_limit - 1) {
@@ -227,80 +925,821 @@ double mcts_rollout(Board *b, int round_limit) {
     }
 }
 
-// Perform n_playout simulations starting from the root node to the leaf,
-// getting the leaf's value and propagating it back through its parents
-void mcts_playout(MCTS *mcts, Board *b) {
+// The loop of a rollout pool worker: take rollouts from the current batch until told to stop
+// The thread that submits a batch runs this loop too, with is_submitter set, and leaves once the batch is handed out
+void rollout_pool_work(RolloutPool *pool, int is_submitter) {
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->stop) {
+        if (pool->next_job >= pool->n_jobs) {
+            if (is_submitter) {
+                break;
+            }
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+            continue;
+        }
+        int job = pool->next_job++;
+        pthread_mutex_unlock(&pool->lock);
+        int n_moves = pool->boards[job].n_moves;
+        pool->values[job] = mcts_rollout(&pool->boards[job], MCTS_ROUND_LIMIT, &pool->rngs[job]);
+        pool->rollout_moves[job] = pool->boards[job].n_moves - n_moves;
+        pthread_mutex_lock(&pool->lock);
+        if (++pool->n_done == pool->n_jobs) {
+            pthread_cond_signal(&pool->work_done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void *rollout_pool_thread(void *arg) {
+    rollout_pool_work((RolloutPool*)arg, 0);
+    return NULL;
+}
+
+// Start n_workers threads that can run batches of up to capacity rollouts
+void rollout_pool_init(RolloutPool *pool, int n_workers, int capacity) {
+    pool->n_workers = n_workers;
+    pool->capacity = capacity;
+    pool->boards = (Board*)malloc(capacity * sizeof(Board));
+    pool->rngs = (uint64_t*)malloc(capacity * sizeof(uint64_t));
+    pool->values = (double*)malloc(capacity * sizeof(double));
+    pool->rollout_moves = (int*)malloc(capacity * sizeof(int));
+    pool->n_jobs = 0;
+    pool->next_job = 0;
+    pool->n_done = 0;
+    pool->stop = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_mutex_init(&pool->submit_lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+    pool->threads = (pthread_t*)malloc(n_workers * sizeof(pthread_t));
+    for (int i = 0; i < n_workers; ++i) {
+        pthread_create(&pool->threads[i], NULL, rollout_pool_thread, pool);
+    }
+}
+
+// Stop the workers and free the pool
+void rollout_pool_free(RolloutPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->n_workers; ++i) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    free(pool->threads);
+    free(pool->boards);
+    free(pool->rngs);
+    free(pool->values);
+    free(pool->rollout_moves);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->submit_lock);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->work_done);
+}
+
+// Evaluate the leaf b with n_rollouts rollouts run on the pool and return their mean value
+// The value is from the perspective of the current player, like mcts_rollout
+// The moves the rollouts played and the rollouts stopped by the round limit are added to *rollout_moves
+// and *n_round_limit, as the rollouts run on copies of b
+double rollout_pool_evaluate(RolloutPool *pool, Board *b, int n_rollouts, uint64_t *rng, int *rollout_moves,
+                             int *n_round_limit) {
+    if (n_rollouts > pool->capacity) {
+        n_rollouts = pool->capacity;
+    }
+    pthread_mutex_lock(&pool->submit_lock);
+    pthread_mutex_lock(&pool->lock);
+    for (int i = 0; i < n_rollouts; ++i) {
+        board_copy(b, &pool->boards[i]);
+        pool->rngs[i] = ((uint64_t)mcts_random(rng) << 32 | mcts_random(rng)) | 1;
+    }
+    pool->n_jobs = n_rollouts;
+    pool->next_job = 0;
+    pool->n_done = 0;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    // Help with the batch, then wait for the rollouts still running on the workers
+    rollout_pool_work(pool, 1);
+    pthread_mutex_lock(&pool->lock);
+    while (pool->n_done < pool->n_jobs) {
+        pthread_cond_wait(&pool->work_done, &pool->lock);
+    }
+    double sum = 0;
+    for (int i = 0; i < n_rollouts; ++i) {
+        sum += pool->values[i];
+        *rollout_moves += pool->rollout_moves[i];
+        *n_round_limit += pool->rollout_moves[i] >= MCTS_ROUND_LIMIT;
+    }
+    pool->n_jobs = 0;
+    pool->next_job = 0;
+    pthread_mutex_unlock(&pool->lock);
+    pthread_mutex_unlock(&pool->submit_lock);
+    return sum / n_rollouts;
+}
+
+// Evaluate every leaf with n_rollouts rollouts run on n_workers extra threads
+// The mean of the rollouts is backed up once, counting as n_rollouts visits
+void mcts_set_leaf_parallel(MCTS *mcts, int n_rollouts, int n_workers) {
+    if (mcts->rollout_pool != NULL) {
+        rollout_pool_free(mcts->rollout_pool);
+        free(mcts->rollout_pool);
+        mcts->rollout_pool = NULL;
+    }
+    mcts->leaf_rollouts = n_rollouts < 1 ? 1 : n_rollouts;
+    if (mcts->leaf_rollouts > 1) {
+        mcts->rollout_pool = (RolloutPool*)malloc(sizeof(RolloutPool));
+        rollout_pool_init(mcts->rollout_pool, n_workers < 0 ? 0 : n_workers, mcts->leaf_rollouts);
+    }
+    if (mcts->evaluator.evaluate == mcts_evaluate_rollouts) {
+        mcts->evaluator.data = mcts->rollout_pool;
+    }
+}
 
+// The default evaluator: the priors come from policy_value_function and the value from a rollout
+// data is the tree's RolloutPool when leaf parallelism is on, and each leaf is then scored by
+// the mean of the pool's batch of rollouts
+void mcts_evaluate_rollouts(void *data, Board **boards, int n_boards, EvaluatorResult *results, uint64_t *rng) {
+    RolloutPool *pool = (RolloutPool*)data;
+    for (int i = 0; i < n_boards; ++i) {
+        EvaluatorResult *result = &results[i];
+        // The priors are read before the rollout plays on the board
+        policy_value_function(boards[i], result->actions, result->priors, &result->actions_count);
+        result->rollout_moves = 0;
+        result->n_round_limit = 0;
+        if (pool != NULL) {
+            result->weight = pool->capacity;
+            result->value = rollout_pool_evaluate(pool, boards[i], pool->capacity, rng, &result->rollout_moves,
+                                                  &result->n_round_limit);
+        } else {
+            int n_moves = boards[i]->n_moves;
+            result->weight = 1;
+            result->value = mcts_rollout(boards[i], MCTS_ROUND_LIMIT, rng);
+            result->rollout_moves = boards[i]->n_moves - n_moves;
+            result->n_round_limit = result->rollout_moves >= MCTS_ROUND_LIMIT;
+        }
+    }
+}
+
+// Score the leaves with evaluate, gathering up to batch_size of them for each call
+// The evaluator must return at least one action for a position that has not ended, and only moves
+// available on its board; NULL restores the rollout evaluator, which then runs on the tree's own pool
+void mcts_set_evaluator(MCTS *mcts, EvaluateFunction evaluate, void *data, int batch_size) {
+    if (evaluate == NULL || evaluate == mcts_evaluate_rollouts) {
+        evaluate = mcts_evaluate_rollouts;
+        data = mcts->rollout_pool;
+    }
+    evaluator_init(&mcts->evaluator, evaluate, data, batch_size);
+    for (int i = 0; i < mcts->n_helpers; ++i) {
+        mcts_set_evaluator(&mcts->helpers[i], evaluate, data, batch_size);
+    }
+}
+
+// Set the budget of the threat solver run at every newly expanded leaf
+// A leaf it proves is scored exactly instead of by a rollout; depth 0 disables it
+void mcts_set_threat_search(MCTS *mcts, int depth, int max_nodes, int use_vct) {
+    mcts->threat_depth = depth < 0 ? 0 : depth;
+    mcts->threat_nodes = max_nodes;
+    mcts->threat_vct = use_vct;
+    for (int i = 0; i < mcts->n_helpers; ++i) {
+        mcts_set_threat_search(&mcts->helpers[i], depth, max_nodes, use_vct);
+    }
+}
+
+// Answer the positions in book from it instead of searching, NULL for no book
+// The book is not owned by the tree and must stay open while it is used
+void mcts_set_book(MCTS *mcts, const Book *book) {
+    mcts->book = book;
+}
+
+// Write a JSON line of search stats for every move to f, NULL to stop
+// It needs a build with MCTS_STATS defined
+void mcts_set_stats_output(MCTS *mcts, FILE *f) {
+#ifndef MCTS_STATS
+    if (f != NULL) {
+        printf("Search stats are not compiled in, build with MCTS_STATS defined.\n");
+        f = NULL;
+    }
+#endif
+    mcts->stats_output = f;
+    mcts->stats.is_enabled = f != NULL;
+    for (int i = 0; i < mcts->n_helpers; ++i) {
+        mcts->helpers[i].stats.is_enabled = f != NULL;
+    }
+}
+
+// The leaves gathered by one call of mcts_playout, waiting for the evaluator
+typedef struct {
+    int capacity; // The most leaves in one batch
+    Board *boards; // A copy of the board at each leaf
+    Board **leaves; // The board each leaf is evaluated on
+    TreeNode **nodes;
+    int *is_new; // 1 if the playout to the leaf claimed it for expansion
+    EvaluatorResult *results;
+    SearchStats stats; // The instrumentation of the thread using the batch
+} MCTSBatch;
+
+void mcts_batch_init(MCTSBatch *batch, int capacity) {
+    batch->capacity = capacity;
+    batch->boards = (Board*)malloc(capacity * sizeof(Board));
+    batch->leaves = (Board**)malloc(capacity * sizeof(Board*));
+    batch->nodes = (TreeNode**)malloc(capacity * sizeof(TreeNode*));
+    batch->is_new = (int*)malloc(capacity * sizeof(int));
+    batch->results = (EvaluatorResult*)malloc(capacity * sizeof(EvaluatorResult));
+    search_stats_init(&batch->stats, 0);
+}
+
+void mcts_batch_free(MCTSBatch *batch) {
+    free(batch->boards);
+    free(batch->leaves);
+    free(batch->nodes);
+    free(batch->is_new);
+    free(batch->results);
+}
+
+// Descend from the root to a leaf, playing the selected moves on b
+TreeNode *mcts_select_leaf(MCTS *mcts, Board *b, int virtual_loss, SearchStats *stats) {
+    (void)stats;
     TreeNode *node = mcts->root;
-    while (node->n_children != 0) {
-        int action;
+    while (tree_node_is_expanded(node) && __atomic_load_n(&node->proven, __ATOMIC_RELAXED) == TREE_NODE_UNPROVEN) {
+        // A full tree gets no new nodes, so the playout ends where the selected edge has no child yet
+        if (__atomic_load_n(&mcts->is_tree_full, __ATOMIC_RELAXED)
+            && __atomic_load_n(&node->children[tree_node_best_edge(node, mcts->c_puct)], __ATOMIC_ACQUIRE) == NULL) {
+            break;
+        }
+        int action, is_new;
         TreeNode *child;
-        tree_node_select(node, mcts->c_puct, &action, &child);
+        tree_node_select(node, &mcts->arena, mcts->c_puct, virtual_loss, &action, &child, &is_new);
         board_do_move(b, action);
         node = child;
+        if (is_new) {
+            SEARCH_STATS_DO(stats, stats->n_new_nodes++);
+            node->hash = b->hash;
+            if (mcts->tt != NULL) {
+                mcts_tt_seed(mcts, node);
+            }
+        }
     }
+    return node;
+}
 
-    // Get actions and action_probs from the policy value function
-    int *actions = NULL;
-    double *action_probs = NULL;
-    int actions_count;
+// Propagate the value of a leaf back through its parents
+// leaf_value is from the perspective of the player to move at the leaf, and the edge into the
+// leaf is updated with -leaf_value because it is from the perspective of the other player
+void mcts_backup(MCTS *mcts, TreeNode *node, double leaf_value, int weight, int virtual_loss) {
+    tree_node_update_recursive(node, -leaf_value, weight, virtual_loss);
+    if (mcts->tt != NULL) {
+        mcts_tt_add_path(mcts, node, -leaf_value, weight);
+    }
+}
+
+// Clear the rollout counts of the results before the evaluator runs, so an evaluator without rollouts
+// need not set them
+void mcts_stats_start_evaluate(MCTSBatch *batch, int n_batch, uint64_t *lap_ns) {
+    for (int i = 0; i < n_batch; ++i) {
+        batch->results[i].rollout_moves = 0;
+        batch->results[i].n_round_limit = 0;
+    }
+    *lap_ns = timer_now_ns();
+}
 
-    policy_value_function(b, &actions, &action_probs, &actions_count);
+// Count the moves the evaluator's rollouts played, and the rollouts cut off by the round limit
+// The evaluator reports them, as leaf parallel rollouts run on copies of the leaves
+void mcts_stats_end_evaluate(SearchStats *stats, MCTSBatch *batch, int n_batch, uint64_t *lap_ns) {
+    search_stats_lap(&stats->evaluate_ns, lap_ns);
+    stats->n_evaluated += n_batch;
+    for (int i = 0; i < n_batch; ++i) {
+        // A rollout evaluator's weight is its number of rollouts
+        stats->n_rollouts += batch->results[i].rollout_moves > 0 ? batch->results[i].weight : 0;
+        stats->rollout_moves += batch->results[i].rollout_moves;
+        stats->n_round_limit += batch->results[i].n_round_limit;
+    }
+}
 
-    // If the game is not ended, expand the tree
+// Perform up to n_leaves simulations from the root, and return how many were done
+// Each simulation descends to a leaf under virtual loss, so the simulations of one batch spread out
+// A leaf decided by the end of the game or by the threat solver is backed up at once with its exact
+// value; the others are gathered into batch and scored by one call of the evaluator, then expanded
+// with its priors and backed up
+// The last leaf is evaluated in place: b is left with its moves and any rollout moves on it,
+// and the caller unwinds them with board_undo_moves
+// rng is the random number generator of the calling thread
+int mcts_playout(MCTS *mcts, Board *b, MCTSBatch *batch, int n_leaves, uint64_t *rng) {
+    n_leaves = n_leaves < batch->capacity ? n_leaves : batch->capacity;
+    int virtual_loss = mcts_is_tree_parallel(mcts) || n_leaves > 1 ? mcts->virtual_loss : 0;
+    int n_moves = b->n_moves;
+    int n_done = 0, n_batch = 0;
+    SearchStats *stats = &batch->stats;
+    uint64_t lap_ns = 0;
+    (void)lap_ns;
+    while (n_done < n_leaves) {
+        // Nothing is left to search once the root is proven
+        if (__atomic_load_n(&mcts->root->proven, __ATOMIC_RELAXED) != TREE_NODE_UNPROVEN) {
+            break;
+        }
+        SEARCH_STATS_DO(stats, lap_ns = timer_now_ns());
+        TreeNode *node = mcts_select_leaf(mcts, b, virtual_loss, stats);
+        int is_last = ++n_done == n_leaves;
+        SEARCH_STATS_DO(stats, search_stats_lap(&stats->select_ns, &lap_ns); stats->n_leaves++;
+                        stats->depth_sum += b->n_moves - n_moves);
+
+        // If the game is not ended, claim the leaf for expansion
+        // If another playout is already expanding this leaf, it is only evaluated
+        // A proven leaf is not searched any further
+        int is_end, winner, is_new_leaf = 0;
+        int proven = __atomic_load_n(&node->proven, __ATOMIC_RELAXED);
+        board_check_end(b, &is_end, &winner);
+        if (!is_end && proven == TREE_NODE_UNPROVEN && !__atomic_load_n(&mcts->is_tree_full, __ATOMIC_RELAXED)) {
+            is_new_leaf = tree_node_claim(node);
+        }
+        if (proven == TREE_NODE_UNPROVEN && is_end && winner != -1) {
+            // The player to move lost to the last move
+            proven = TREE_NODE_PROVEN_LOSS;
+            tree_node_prove(node, proven);
+        }
+        if (proven == TREE_NODE_UNPROVEN && is_new_leaf && mcts->threat_depth > 0) {
+            int winning_move;
+            proven = threat_search(b, mcts->threat_depth, mcts->threat_nodes, mcts->threat_vct, &winning_move);
+            if (proven != TREE_NODE_UNPROVEN) {
+                // The evaluator is not needed, but the node still gets its edges so the winning one can be proven
+                int actions[BOARD_MAX_CELLS];
+                double action_probs[BOARD_MAX_CELLS];
+                int actions_count;
+                policy_value_function(b, actions, action_probs, &actions_count);
+                if (proven == THREAT_WIN) {
+                    mcts_add_action(actions, action_probs, &actions_count, winning_move);
+                }
+                tree_node_expand(node, &mcts->arena, actions, action_probs, actions_count);
+            }
+            if (proven == THREAT_WIN) {
+                // The winning move's child is lost for the opponent, which proves this node won
+                for (int i = 0; i < node->n_children; ++i) {
+                    if (node->actions[i] == winning_move) {
+                        tree_node_prove_edge(node, i, TREE_NODE_PROVEN_LOSS);
+                        break;
+                    }
+                }
+            } else if (proven == THREAT_LOSS) {
+                tree_node_prove(node, TREE_NODE_PROVEN_LOSS);
+            }
+            SEARCH_STATS_DO(stats, stats->n_proven += proven != TREE_NODE_UNPROVEN);
+        }
+        SEARCH_STATS_DO(stats, search_stats_lap(&stats->expand_ns, &lap_ns); stats->n_terminal += is_end);
+
+        if (proven != TREE_NODE_UNPROVEN || is_end) {
+            // A proven leaf gets its exact value, and a full board is a draw
+            mcts_backup(mcts, node, proven, 1, virtual_loss);
+            SEARCH_STATS_DO(stats, search_stats_lap(&stats->backup_ns, &lap_ns));
+        } else {
+            batch->nodes[n_batch] = node;
+            batch->is_new[n_batch] = is_new_leaf;
+            if (is_last) {
+                batch->leaves[n_batch++] = b;
+                break;
+            }
+            board_copy(b, &batch->boards[n_batch]);
+            batch->leaves[n_batch] = &batch->boards[n_batch];
+            n_batch++;
+        }
+        if (!is_last) {
+            board_undo_moves(b, n_moves);
+        }
+    }
+    if (n_batch == 0) {
+        return n_done;
+    }
+
+    SEARCH_STATS_DO(stats, mcts_stats_start_evaluate(batch, n_batch, &lap_ns));
+    mcts->evaluator.evaluate(mcts->evaluator.data, batch->leaves, n_batch, batch->results, rng);
+    SEARCH_STATS_DO(stats, mcts_stats_end_evaluate(stats, batch, n_batch, &lap_ns));
+    for (int i = 0; i < n_batch; ++i) {
+        EvaluatorResult *result = &batch->results[i];
+        if (batch->is_new[i]) {
+            SEARCH_STATS_DO(stats, lap_ns = timer_now_ns());
+            tree_node_expand(batch->nodes[i], &mcts->arena, result->actions, result->priors, result->actions_count);
+            SEARCH_STATS_DO(stats, search_stats_lap(&stats->expand_ns, &lap_ns));
+        }
+        SEARCH_STATS_DO(stats, lap_ns = timer_now_ns());
+        mcts_backup(mcts, batch->nodes[i], result->value, result->weight, virtual_loss);
+        SEARCH_STATS_DO(stats, search_stats_lap(&stats->backup_ns, &lap_ns));
+    }
+    return n_done;
+}
+
+// Release the whole tree and start again from a new root
+void mcts_reset_tree(MCTS *mcts) {
+    arena_reset(&mcts->arena);
+    mcts->root = (TreeNode*)arena_alloc(&mcts->arena, sizeof(TreeNode));
+    tree_node_init(mcts->root, NULL, -1);
+    mcts->root_n_moves = -1;
+    mcts->is_tree_full = 0;
+}
+
+// Return the bytes the tree may take from its arena under its budget
+// The arena may reserve as many whole slabs as fit in half the tree budget, and a slab can be left
+// with up to one node's edges unused at its end when the next allocation does not fit
+size_t mcts_arena_limit(MCTS *mcts) {
+    size_t slab_total = mcts->arena.slab_size + ARENA_SLAB_HEADER;
+    size_t n_slabs = mcts->tree_budget / 2 / slab_total;
+    return n_slabs * (mcts->arena.slab_size - tree_node_edges_size(BOARD_MAX_CELLS));
+}
+
+// Return 1 if the arena has no room for n_leaves more leaves, each with a node and a full set of edges
+int mcts_tree_is_full(MCTS *mcts, int n_leaves) {
+    size_t headroom = (size_t)n_leaves * (arena_round_size(sizeof(TreeNode)) + tree_node_edges_size(BOARD_MAX_CELLS));
+    return __atomic_load_n(&mcts->arena.bytes_used, __ATOMIC_RELAXED) + headroom > mcts_arena_limit(mcts);
+}
+
+// Return the smallest visit count that subtrees must have to be kept, for the subtree under node to be
+// copied into half the arena limit; 0 keeps everything when there is no budget
+int mcts_min_visits_to_fit(MCTS *mcts, TreeNode *node) {
+    if (mcts->tree_budget == 0) {
+        return 0;
+    }
+    size_t target = mcts_arena_limit(mcts) / 2;
+    int min_visits = 0;
+    while (min_visits <= node->n_visits && tree_node_copy_size(node, NULL, min_visits) > target) {
+        min_visits = min_visits == 0 ? 2 : 2 * min_visits;
+    }
+    return min_visits;
+}
+
+// Make node the root, copying its subtree with min_visits into the spare arena and then swapping arenas,
+// which frees the rest of the tree at once
+void mcts_move_root(MCTS *mcts, TreeNode *node, int min_visits) {
+    arena_reset(&mcts->spare_arena);
+    TreeNode *new_root = tree_node_copy(node, &mcts->spare_arena, NULL, min_visits);
+    arena_swap(&mcts->arena, &mcts->spare_arena);
+    arena_reset(&mcts->spare_arena);
+    mcts->root = new_root;
+}
+
+// Keep the tree within its budget before playouts that may add up to n_leaves leaves
+// With can_compact set, no other thread is in the tree, so it is compacted in place; otherwise it stops growing
+void mcts_keep_within_budget(MCTS *mcts, int n_leaves, int can_compact) {
+    if (mcts->tree_budget == 0 || __atomic_load_n(&mcts->is_tree_full, __ATOMIC_RELAXED)
+        || !mcts_tree_is_full(mcts, n_leaves)) {
+        return;
+    }
+    if (can_compact) {
+        mcts_move_root(mcts, mcts->root, mcts_min_visits_to_fit(mcts, mcts->root));
+    }
+    // If even the root's edges leave no room, the tree stops growing
+    if (!can_compact || mcts_tree_is_full(mcts, n_leaves)) {
+        __atomic_store_n(&mcts->is_tree_full, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// Set the wall-clock budget of a search in milliseconds, 0 for no limit
+// A search stops at whichever comes first of n_playout playouts and the time budget;
+// n_playout <= 0 removes the playout limit, so then a time budget is required
+void mcts_set_time_budget(MCTS *mcts, double time_budget_ms) {
+    mcts->time_budget_ms = time_budget_ms;
+}
+
+// The clock is read and the root checked every this many playouts
+#define MCTS_CHECK_INTERVAL 16
+
+// Return 1 if the most visited root edge cannot be overtaken by remaining_visits more visits
+int mcts_root_is_decided(TreeNode *root, long remaining_visits) {
+    int best = -1, second = -1;
+    for (int i = 0; i < root->n_children; ++i) {
+        int visits = __atomic_load_n(&root->edge_visits[i], __ATOMIC_RELAXED);
+        if (visits > best) {
+            second = best;
+            best = visits;
+        } else if (visits > second) {
+            second = visits;
+        }
+    }
+    return root->n_children > 0 && (long)best - (second < 0 ? 0 : second) > remaining_visits;
+}
+
+// Run up to n_playout playouts from the root, stopping at deadline_ns on timer_now_ns (0 for none),
+// or earlier once the most visited root edge is certain to stay ahead
+// n_searchers is the number of threads adding playouts to this tree at the same rate
+// All playouts share one copy of the board and undo their moves when they finish
+// The playouts run in batches of the evaluator's batch size
+void mcts_search(MCTS *mcts, Board *b, int n_playout, uint64_t deadline_ns, int n_searchers, uint64_t *rng) {
+    Board b_search;
+    board_copy(b, &b_search);
+    int n_moves = b_search.n_moves;
+    MCTSBatch batch;
+    mcts_batch_init(&batch, mcts->evaluator.batch_size);
+    batch.stats.is_enabled = mcts->stats.is_enabled;
+    uint64_t start_ns = deadline_ns != 0 ? timer_now_ns() : 0;
+    int i = 0, next_check = MCTS_CHECK_INTERVAL;
+    while (i < n_playout) {
+        // Nothing is left to search once the root is proven
+        if (__atomic_load_n(&mcts->root->proven, __ATOMIC_RELAXED) != TREE_NODE_UNPROVEN) {
+            break;
+        }
+        mcts_keep_within_budget(mcts, n_searchers * batch.capacity, n_searchers == 1);
+        i += mcts_playout(mcts, &b_search, &batch, n_playout - i, rng);
+        board_undo_moves(&b_search, n_moves);
+
+        if (i < next_check) {
+            continue;
+        }
+        next_check = i + MCTS_CHECK_INTERVAL;
+        // Bound the playouts still to come by the playout limit and by the rate so far
+        long remaining = n_playout == INT_MAX ? LONG_MAX : (long)(n_playout - i);
+        if (deadline_ns != 0) {
+            uint64_t now_ns = timer_now_ns();
+            if (now_ns >= deadline_ns) {
+                break;
+            }
+            double rate = (double)i / (double)(now_ns - start_ns + 1);
+            long by_time = (long)(rate * (double)(deadline_ns - now_ns)) + 1;
+            remaining = by_time < remaining ? by_time : remaining;
+        }
+        if (remaining != LONG_MAX
+            && mcts_root_is_decided(mcts->root, remaining * n_searchers * mcts->leaf_rollouts)) {
+            break;
+        }
+    }
+    SEARCH_STATS_DO(&batch.stats, search_stats_merge(&mcts->stats, &batch.stats));
+    mcts_batch_free(&batch);
+}
+
+// Run playouts from the root until *stop is set or the root is proven
+// Pondering is not counted in the search stats, which cover the searches of mcts_get_action
+void mcts_search_until_stopped(MCTS *mcts, Board *b, int *stop, uint64_t *rng) {
+    Board b_search;
+    board_copy(b, &b_search);
+    int n_moves = b_search.n_moves;
+    MCTSBatch batch;
+    mcts_batch_init(&batch, mcts->evaluator.batch_size);
+    while (!__atomic_load_n(stop, __ATOMIC_ACQUIRE)
+           && __atomic_load_n(&mcts->root->proven, __ATOMIC_RELAXED) == TREE_NODE_UNPROVEN) {
+        mcts_keep_within_budget(mcts, batch.capacity, 1);
+        mcts_playout(mcts, &b_search, &batch, batch.capacity, rng);
+        board_undo_moves(&b_search, n_moves);
+    }
+    mcts_batch_free(&batch);
+}
+
+void *mcts_ponder_thread(void *arg) {
+    MCTS *mcts = (MCTS*)arg;
+    mcts_search_until_stopped(mcts, &mcts->ponder_board, &mcts->stop_ponder, &mcts->rng);
+    return NULL;
+}
+
+// Start searching from b in the background while the opponent thinks about their move
+// b must be the position at the root, as it is after the engine's own move
+// Pondering stops by itself when the tree is next used by mcts_get_action or mcts_update_with_move
+void mcts_start_ponder(MCTS *mcts, Board *b) {
+    mcts_stop_ponder(mcts);
     int is_end, winner;
     board_check_end(b, &is_end, &winner);
-    if (!is_end) {
-        tree_node_expand(node, actions, action_probs, actions_count);
+    if (is_end) {
+        return;
     }
+    if (mcts->root_n_moves != b->n_moves || mcts->root->hash != b->hash) {
+        mcts_reset_tree(mcts);
+    }
+    mcts->root_n_moves = b->n_moves;
+    mcts->root->hash = b->hash;
+    if (mcts->tt != NULL) {
+        tt_clear(mcts->tt);
+    }
+    board_copy(b, &mcts->ponder_board);
+    mcts->stop_ponder = 0;
+    mcts->is_pondering = 1;
+    pthread_create(&mcts->ponder_thread, NULL, mcts_ponder_thread, mcts);
+}
 
-    // Update the leaf node recursively
-    double leaf_value;
-    leaf_value = mcts_rollout(b, 1000);
+void mcts_stop_ponder(MCTS *mcts) {
+    if (!mcts->is_pondering) {
+        return;
+    }
+    __atomic_store_n(&mcts->stop_ponder, 1, __ATOMIC_RELEASE);
+    pthread_join(mcts->ponder_thread, NULL);
+    mcts->is_pondering = 0;
+}
 
-    // update value and visit count of nodes in this traversal with -leaf_value
-    // because it is from the perspective of the other player
-    tree_node_update_recursive(node, -leaf_value);
+// Add the visit count of every root edge to visits, which is indexed by move
+// Moves proven to win are marked in is_won and moves proven to lose in is_lost
+void mcts_get_root_visits(MCTS *mcts, int *visits, int *is_won, int *is_lost) {
+    for (int i = 0; i < mcts->root->n_children; ++i) {
+        int move = mcts->root->actions[i];
+        visits[move] += mcts->root->edge_visits[i];
+        is_won[move] |= mcts->root->edge_proven[i] == TREE_NODE_PROVEN_LOSS;
+        is_lost[move] |= mcts->root->edge_proven[i] == TREE_NODE_PROVEN_WIN;
+    }
 }
 
-// Run all playouts sequentially and return the most visited action
+// The work given to one thread of a parallel search
+typedef struct {
+    MCTS *mcts;
+    Board *b;
+    int n_playout;
+    uint64_t deadline_ns;
+    int n_searchers;
+    uint64_t *rng;
+} MCTSSearchTask;
+
+void *mcts_search_thread(void *arg) {
+    MCTSSearchTask *task = (MCTSSearchTask*)arg;
+    mcts_search(task->mcts, task->b, task->n_playout, task->deadline_ns, task->n_searchers, task->rng);
+    return NULL;
+}
+
+// Run the playouts of a search on n_threads threads, each with a share of the playouts
+// In root parallel mode each thread searches its own tree, in tree parallel mode they all search mcts
+void mcts_search_parallel(MCTS *mcts, Board *b, int n_playout, uint64_t deadline_ns) {
+    int n_threads = mcts->n_threads;
+    pthread_t *threads = (pthread_t*)malloc((n_threads - 1) * sizeof(pthread_t));
+    // Zeroed, so no field of a task is ever read uninitialized, whichever mode fills it
+    MCTSSearchTask *tasks = (MCTSSearchTask*)calloc(n_threads, sizeof(MCTSSearchTask));
+    uint64_t *rngs = (uint64_t*)calloc(n_threads, sizeof(uint64_t));
+    for (int i = 0; i < n_threads; ++i) {
+        if (mcts->parallel_mode == MCTS_PARALLEL_ROOT) {
+            tasks[i].mcts = i == 0 ? mcts : &mcts->helpers[i - 1];
+            tasks[i].rng = &tasks[i].mcts->rng;
+        } else {
+            // Derive an independent generator for every thread from the tree's own
+            tasks[i].mcts = mcts;
+            rngs[i] = ((uint64_t)mcts_random(&mcts->rng) << 32 | mcts_random(&mcts->rng)) | 1;
+            tasks[i].rng = &rngs[i];
+        }
+        tasks[i].b = b;
+        tasks[i].n_playout = n_playout == INT_MAX ? INT_MAX : n_playout / n_threads + (i < n_playout % n_threads);
+        tasks[i].deadline_ns = deadline_ns;
+        tasks[i].n_searchers = mcts->parallel_mode == MCTS_PARALLEL_TREE ? n_threads : 1;
+    }
+    // This thread does the first share while the others do the rest
+    for (int i = 1; i < n_threads; ++i) {
+        pthread_create(&threads[i - 1], NULL, mcts_search_thread, &tasks[i]);
+    }
+    mcts_search_thread(&tasks[0]);
+    for (int i = 1; i < n_threads; ++i) {
+        pthread_join(threads[i - 1], NULL);
+    }
+    free(threads);
+    free(tasks);
+    free(rngs);
+}
+
+// Write the stats of the search for the move action from b as a JSON line, then clear them for the next move
+// The stats of the helper trees are summed in, and the root is summarized over all trees
+void mcts_stats_report(MCTS *mcts, Board *b, int action, uint64_t start_ns, int is_book) {
+    SearchStats *stats = &mcts->stats;
+    long root_visits = 0, action_visits = 0;
+    double action_value_sum = 0;
+    size_t tree_bytes = 0;
+    for (int t = 0; t <= mcts->n_helpers; ++t) {
+        MCTS *tree = t == 0 ? mcts : &mcts->helpers[t - 1];
+        if (t > 0) {
+            search_stats_merge(stats, &tree->stats);
+            search_stats_init(&tree->stats, tree->stats.is_enabled);
+        }
+        root_visits += tree->root->n_visits;
+        tree_bytes += tree->arena.bytes_reserved;
+        for (int i = 0; i < tree->root->n_children; ++i) {
+            if (tree->root->actions[i] == action) {
+                action_visits += tree->root->edge_visits[i];
+                action_value_sum += tree->root->edge_value_sums[i];
+            }
+        }
+    }
+    // The line is written with one call, so the lines of engines sharing the output do not mix
+    char counts[512];
+    char line[1024];
+    search_stats_format(stats, counts, sizeof(counts));
+    snprintf(line, sizeof(line), "{\"move_number\":%d,\"action\":%d,\"book\":%d,\"time_ms\":%.3f,%s,"
+                                 "\"root\":{\"visits\":%ld,\"children\":%d,\"action_visits\":%ld,\"action_q\":%.4f,"
+                                 "\"proven\":%d,\"trees\":%d,\"tree_bytes\":%zu}}\n",
+             b->n_moves, action, is_book, (timer_now_ns() - start_ns) * 1e-6, counts, root_visits,
+             mcts->root->n_children, action_visits, action_visits > 0 ? action_value_sum / action_visits : 0.0,
+             mcts->root->proven, mcts->n_helpers + 1, tree_bytes);
+    fputs(line, mcts->stats_output);
+    fflush(mcts->stats_output);
+    search_stats_init(stats, stats->is_enabled);
+}
+
+// Run all playouts and return the most visited action
+// With several threads in root parallel mode, the root visit counts of all trees are merged before choosing
+// A position in the opening book is answered from the book without searching
 void mcts_get_action(MCTS *mcts, Board *b, int *action) {
-    for (int i = 0; i < mcts->n_playout; ++i) {
-        Board b_copy;
-        board_copy(b, &b_copy);
-        mcts_playout(mcts, &b_copy);
-        board_free(&b_copy);
+    mcts_stop_ponder(mcts);
+    uint64_t stats_start_ns = 0;
+    (void)stats_start_ns;
+    SEARCH_STATS_DO(&mcts->stats, stats_start_ns = timer_now_ns());
+    if (mcts->book != NULL && book_lookup(mcts->book, b, action)) {
+        SEARCH_STATS_DO(&mcts->stats, mcts_stats_report(mcts, b, *action, stats_start_ns, 1));
+        return;
+    }
+    // A tree kept from an earlier move must be rooted at this position
+    if (mcts->root_n_moves != -1 && (mcts->root_n_moves != b->n_moves || mcts->root->hash != b->hash)) {
+        mcts_reset_tree(mcts);
+        for (int i = 0; i < mcts->n_helpers; ++i) {
+            mcts_reset_tree(&mcts->helpers[i]);
+        }
+    }
+    mcts->root_n_moves = b->n_moves;
+    mcts->root->hash = b->hash;
+    for (int i = 0; i < mcts->n_helpers; ++i) {
+        mcts->helpers[i].root_n_moves = b->n_moves;
+        mcts->helpers[i].root->hash = b->hash;
+    }
+    // Entries left from searches under other roots would seed edges with playouts that never went
+    // through this root, and could decide the move on them
+    if (mcts->tt != NULL) {
+        tt_clear(mcts->tt);
+    }
+    int n_playout = mcts->n_playout > 0 ? mcts->n_playout : INT_MAX;
+    uint64_t deadline_ns = 0;
+    if (mcts->time_budget_ms > 0) {
+        deadline_ns = timer_now_ns() + (uint64_t)(mcts->time_budget_ms * 1e6);
+    }
+    // A root proven by an earlier search needs no more playouts
+    if (mcts->root->proven == TREE_NODE_UNPROVEN) {
+        if (mcts->n_threads == 1) {
+            mcts_search(mcts, b, n_playout, deadline_ns, 1, &mcts->rng);
+        } else {
+            mcts_search_parallel(mcts, b, n_playout, deadline_ns);
+        }
     }
 
-    // Choose the action with the highest visit count
-    int max_n_visits = -1;
-    for (int i = 0; i < mcts->root->n_children; ++i) {
-        TreeNode *child = mcts->root->children[i];
-        if (child->n_visits > max_n_visits) {
-            max_n_visits = child->n_visits;
-            *action = mcts->root->actions[i];
+    // Merge the root visit counts of all trees and choose the action with the highest total
+    // A move proven to win is played at once, and a move proven to lose only if every move loses
+    // Only moves the search visited or proved are candidates, so a lost root never falls to a square
+    // progressive widening left closed, and forbidden squares are skipped
+    // If the budget ran out before the root was expanded, fall back to the first legal move available
+    int visits[BOARD_MAX_CELLS] = {0};
+    int is_won[BOARD_MAX_CELLS] = {0};
+    int is_lost[BOARD_MAX_CELLS] = {0};
+    mcts_get_root_visits(mcts, visits, is_won, is_lost);
+    for (int i = 0; i < mcts->n_helpers; ++i) {
+        mcts_get_root_visits(&mcts->helpers[i], visits, is_won, is_lost);
+    }
+    *action = -1;
+    long max_score = LONG_MIN;
+    for (int i = 0; i < b->moves_available_count; ++i) {
+        int move = b->moves_available[i];
+        if ((visits[move] == 0 && !is_won[move] && !is_lost[move]) || board_check_forbidden(b, move)) {
+            continue;
         }
+        long score = is_won[move] ? LONG_MAX : is_lost[move] ? (long)visits[move] - INT_MAX : visits[move];
+        if (score > max_score) {
+            max_score = score;
+            *action = move;
+        }
+    }
+    for (int i = 0; i < b->moves_available_count && *action == -1; ++i) {
+        if (!board_check_forbidden(b, b->moves_available[i])) {
+            *action = b->moves_available[i];
+        }
+    }
+    if (*action == -1) {
+        *action = b->moves_available[0];
+    }
+    // A lost position is only lost to an opponent who finds the win, so the move that resists longest
+    // is played: one of the opponent's winning squares is blocked, the most visited if several are open
+    int is_root_lost = max_score < 0;
+    for (int i = 0; i <= mcts->n_helpers; ++i) {
+        MCTS *tree = i == 0 ? mcts : &mcts->helpers[i - 1];
+        is_root_lost |= tree->root->proven == TREE_NODE_PROVEN_LOSS;
     }
+    if (is_root_lost) {
+        int wins[BOARD_MAX_CELLS];
+        int n_wins = threat_find_wins(b, 1 - b->current_player, wins);
+        int max_visits = -1;
+        for (int i = 0; i < n_wins; ++i) {
+            if (visits[wins[i]] > max_visits && !board_check_forbidden(b, wins[i])) {
+                max_visits = visits[wins[i]];
+                *action = wins[i];
+            }
+        }
+    }
+    SEARCH_STATS_DO(&mcts->stats, mcts_stats_report(mcts, b, *action, stats_start_ns, 0));
 }
 
 // Step forward in the tree, keeping everything we already know about the subtree
+// The kept subtree is copied into the spare arena and the old arena is reset, which frees the
+// root and all sibling subtrees; -1 drops the whole tree
 void mcts_update_with_move(MCTS *mcts, int last_move) {
-    // If the last move is a child of the root, set the root to the child
-    int is_child = 0;
+    // Pondering searched from the old root, let it finish before the tree moves
+    mcts_stop_ponder(mcts);
+    // If the last move leads to a child of the root, set the root to the child
+    TreeNode *child = NULL;
     for (int i = 0; i < mcts->root->n_children; ++i) {
         if (mcts->root->actions[i] == last_move) {
-            mcts->root = mcts->root->children[i];
-            mcts->root->parent = NULL;
-            is_child = 1;
+            child = mcts->root->children[i];
             break;
         }
     }
-    // If the last move is not a child of the root, set the root to a new node
-    if (!is_child) {
-        tree_node_free(mcts->root);
-        TreeNode *new_root = (TreeNode*)malloc(sizeof(TreeNode));
-        tree_node_init(new_root, NULL, 1.0);
-        mcts->root = new_root;
+    if (child != NULL) {
+        // Under a memory budget, the least visited parts of the subtree are left behind so it has room to grow
+        mcts_move_root(mcts, child, mcts_min_visits_to_fit(mcts, child));
+        mcts->is_tree_full = 0;
+        mcts->root_n_moves = mcts->root_n_moves == -1 ? -1 : mcts->root_n_moves + 1;
+    } else {
+        // If the last move is not a child of the root, release the whole tree and start from a new node
+        mcts_reset_tree(mcts);
+    }
+    for (int i = 0; i < mcts->n_helpers; ++i) {
+        mcts_update_with_move(&mcts->helpers[i], last_move);
     }
 }
 #endif //GOMOKU_MCTS_C_MCTS_H
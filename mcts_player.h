@@ -13,10 +13,16 @@ typedef struct {
 } MCTSPlayer;
 
 // Initialize the MCTS player
-void mcts_player_init(MCTSPlayer *player,int c_puct, int n_playout) {
-    MCTS mcts;
-    mcts_init(&mcts, c_puct, n_playout);
-    player->mcts = mcts;
+// n_threads is the number of threads searching for each move, each with its own tree
+void mcts_player_init(MCTSPlayer *player,int c_puct, int n_playout, int n_threads) {
+    mcts_init(&player->mcts, c_puct, n_playout);
+    mcts_set_threads(&player->mcts, n_threads);
+}
+
+// Initialize the MCTS player with its searches seeded from seed instead of rand()
+void mcts_player_init_seeded(MCTSPlayer *player, int c_puct, int n_playout, int n_threads, uint64_t seed) {
+    mcts_init_seeded(&player->mcts, c_puct, n_playout, seed);
+    mcts_set_threads(&player->mcts, n_threads);
 }
 
 // Free the memory allocated for the MCTS player
@@ -24,14 +30,73 @@ void mcts_player_free(MCTSPlayer *player) {
     mcts_free(&player->mcts);
 }
 
+// Limit each of the MCTS player's searches to time_budget_ms milliseconds, 0 for no limit
+void mcts_player_set_time_budget(MCTSPlayer *player, double time_budget_ms) {
+    mcts_set_time_budget(&player->mcts, time_budget_ms);
+}
+
+// Give the MCTS player a transposition table of memory_bytes bytes, 0 disables it
+void mcts_player_set_transposition_table(MCTSPlayer *player, size_t memory_bytes) {
+    mcts_set_transposition_table(&player->mcts, memory_bytes);
+}
+
+// Cap the memory of the MCTS player's search trees at memory_bytes, 0 for no limit
+void mcts_player_set_memory_budget(MCTSPlayer *player, size_t memory_bytes) {
+    mcts_set_memory_budget(&player->mcts, memory_bytes);
+}
+
+// Set the budget of the MCTS player's threat solver, depth 0 disables it
+void mcts_player_set_threat_search(MCTSPlayer *player, int depth, int max_nodes, int use_vct) {
+    mcts_set_threat_search(&player->mcts, depth, max_nodes, use_vct);
+}
+
+// Play the MCTS player's moves from book while it has the position, NULL for no book
+void mcts_player_set_book(MCTSPlayer *player, const Book *book) {
+    mcts_set_book(&player->mcts, book);
+}
+
+// Write a JSON line of search stats for each of the MCTS player's moves to f, NULL to stop
+void mcts_player_set_stats_output(MCTSPlayer *player, FILE *f) {
+    mcts_set_stats_output(&player->mcts, f);
+}
+
+// Score the MCTS player's leaves with evaluate in batches of batch_size, NULL for rollouts
+void mcts_player_set_evaluator(MCTSPlayer *player, EvaluateFunction evaluate, void *data, int batch_size) {
+    mcts_set_evaluator(&player->mcts, evaluate, data, batch_size);
+}
+
 // Get the MCTS player's action
+// The tree is advanced through the chosen move, so its subtree is kept for the next search
 void mcts_player_get_action(MCTSPlayer *player, Board *b, int *move) {
     int _move;
     mcts_get_action(&player->mcts, b, &_move);
-    mcts_update_with_move(&player->mcts, -1);
+    mcts_update_with_move(&player->mcts, _move);
     *move = _move;
 }
 
+// Search from b and get the MCTS player's action, with the root visits of the search indexed by move
+// The tree is not advanced, so another move may be played; pass the move played to mcts_player_update_with_move
+void mcts_player_get_action_with_visits(MCTSPlayer *player, Board *b, int *move, int *visits) {
+    int is_won[BOARD_MAX_CELLS] = {0};
+    int is_lost[BOARD_MAX_CELLS] = {0};
+    mcts_get_action(&player->mcts, b, move);
+    memset(visits, 0, b->width * b->height * sizeof(int));
+    mcts_get_root_visits(&player->mcts, visits, is_won, is_lost);
+    for (int i = 0; i < player->mcts.n_helpers; ++i) {
+        mcts_get_root_visits(&player->mcts.helpers[i], visits, is_won, is_lost);
+    }
+}
+
+// Tell the MCTS player about the opponent's move, keeping the subtree below it
+void mcts_player_update_with_move(MCTSPlayer *player, int move) {
+    mcts_update_with_move(&player->mcts, move);
+}
+
+// Keep searching from b while the opponent thinks, until the player's tree is next used
+void mcts_player_start_ponder(MCTSPlayer *player, Board *b) {
+    mcts_start_ponder(&player->mcts, b);
+}
+
 // Reset the MCTS player
 void mcts_player_reset_player(MCTSPlayer *player) {
     mcts_update_with_move(&player->mcts, -1);
@@ -0,0 +1,750 @@
+//
+// Created by diex on 10/17/2026.
+//
+
+#ifndef GOMOKU_MCTS_C_NN_H
+#define GOMOKU_MCTS_C_NN_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#include "board.h"
+#include "evaluator.h"
+#include "timer.h"
+
+// A small policy-value residual network evaluated on the CPU
+// The input is NN_INPUT_PLANES planes over the board: the stones of the player to move, the
+// opponent's stones, the last move, and a plane of ones that marks the board inside the zero padding.
+// A 3x3 convolution takes them to channels planes, followed by n_blocks residual blocks of two 3x3
+// convolutions. The policy head is a 1x1 convolution to one logit per square, and the value head
+// averages every channel over the board and applies two fully connected layers and tanh.
+// The network is fully convolutional, so one set of weights plays on every board size.
+// Batch normalization is expected to be folded into the weights and biases of the convolutions.
+//
+// Activations are stored channels last with a border of one zero square, so each output square
+// reads its 3x3 neighborhood without bounds checks, and the kernels vectorize over output channels.
+// With nn_quantize, the convolutions run on int8 weights and 7 bit activations instead of floats.
+//
+// To search with it, pass nn_evaluate and an NNEvaluator of the network to mcts_set_evaluator.
+
+#define NN_INPUT_PLANES 4
+// The network's channels must be a multiple of this, the width of the convolution kernels
+#define NN_CHANNEL_BLOCK 16
+
+// The weight file starts with NN_MAGIC, NN_VERSION, the number of input planes, channels, n_blocks
+// and value_hidden as 32 bit integers, followed by 32 bit floats in the order of nn_tensors
+#define NN_MAGIC 0x4E4E4D47 // "GMNN"
+#define NN_VERSION 1
+
+// The leaves the search gathers for each call of nn_evaluate
+#define NN_DEFAULT_BATCH_SIZE 8
+
+// Define a 3x3 convolution
+typedef struct {
+    int in_channels;
+    int out_channels;
+    float *weights; // [tap][in][out], the 9 taps in row order
+    float *bias; // [out]
+    int8_t *qweights; // [tap][in / 4][out][4], NULL until the convolution is quantized
+    float *qscales; // The scale of each output channel's int8 weights
+} NNConv;
+
+// Define the NeuralNet struct
+typedef struct {
+    int channels;
+    int n_blocks;
+    int value_hidden;
+    NNConv stem;
+    NNConv *convs; // Two for every residual block
+    float *policy_weights; // [channels]
+    float *policy_bias; // [1]
+    float *value_weights1; // [channels][value_hidden]
+    float *value_bias1; // [value_hidden]
+    float *value_weights2; // [value_hidden]
+    float *value_bias2; // [1]
+    int is_quantized;
+} NeuralNet;
+
+void nn_conv_alloc(NNConv *conv, int in_channels, int out_channels) {
+    conv->in_channels = in_channels;
+    conv->out_channels = out_channels;
+    conv->weights = (float*)malloc((size_t)9 * in_channels * out_channels * sizeof(float));
+    conv->bias = (float*)malloc((size_t)out_channels * sizeof(float));
+    conv->qweights = NULL;
+    conv->qscales = NULL;
+}
+
+void nn_conv_free(NNConv *conv) {
+    free(conv->weights);
+    free(conv->bias);
+    free(conv->qweights);
+    free(conv->qscales);
+}
+
+// Allocate the tensors of a network, their values are left unset
+void nn_alloc(NeuralNet *net, int channels, int n_blocks, int value_hidden) {
+    net->channels = channels;
+    net->n_blocks = n_blocks;
+    net->value_hidden = value_hidden;
+    nn_conv_alloc(&net->stem, NN_INPUT_PLANES, channels);
+    net->convs = (NNConv*)malloc((size_t)(2 * n_blocks > 0 ? 2 * n_blocks : 1) * sizeof(NNConv));
+    for (int i = 0; i < 2 * n_blocks; ++i) {
+        nn_conv_alloc(&net->convs[i], channels, channels);
+    }
+    net->policy_weights = (float*)malloc(channels * sizeof(float));
+    net->policy_bias = (float*)malloc(sizeof(float));
+    net->value_weights1 = (float*)malloc((size_t)channels * value_hidden * sizeof(float));
+    net->value_bias1 = (float*)malloc(value_hidden * sizeof(float));
+    net->value_weights2 = (float*)malloc(value_hidden * sizeof(float));
+    net->value_bias2 = (float*)malloc(sizeof(float));
+    net->is_quantized = 0;
+}
+
+void nn_free(NeuralNet *net) {
+    nn_conv_free(&net->stem);
+    for (int i = 0; i < 2 * net->n_blocks; ++i) {
+        nn_conv_free(&net->convs[i]);
+    }
+    free(net->convs);
+    free(net->policy_weights);
+    free(net->policy_bias);
+    free(net->value_weights1);
+    free(net->value_bias1);
+    free(net->value_weights2);
+    free(net->value_bias2);
+    net->convs = NULL;
+}
+
+// List the tensors of a network in weight file order, and return how many there are
+int nn_tensors(NeuralNet *net, float **tensors, size_t *sizes) {
+    int n = 0;
+    size_t c = (size_t)net->channels, h = (size_t)net->value_hidden;
+    tensors[n] = net->stem.weights;
+    sizes[n++] = 9 * NN_INPUT_PLANES * c;
+    tensors[n] = net->stem.bias;
+    sizes[n++] = c;
+    for (int i = 0; i < 2 * net->n_blocks; ++i) {
+        tensors[n] = net->convs[i].weights;
+        sizes[n++] = 9 * c * c;
+        tensors[n] = net->convs[i].bias;
+        sizes[n++] = c;
+    }
+    tensors[n] = net->policy_weights;
+    sizes[n++] = c;
+    tensors[n] = net->policy_bias;
+    sizes[n++] = 1;
+    tensors[n] = net->value_weights1;
+    sizes[n++] = c * h;
+    tensors[n] = net->value_bias1;
+    sizes[n++] = h;
+    tensors[n] = net->value_weights2;
+    sizes[n++] = h;
+    tensors[n] = net->value_bias2;
+    sizes[n++] = 1;
+    return n;
+}
+
+// The most tensors a network with n_blocks blocks has
+#define NN_MAX_TENSORS(n_blocks) (8 + 4 * (n_blocks))
+
+// Load a network from a weight file, return 1 on success
+// On failure a message is printed and nothing is left allocated
+int nn_load(NeuralNet *net, const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        printf("Cannot open the weight file %s.\n", path);
+        return 0;
+    }
+    int32_t header[6];
+    if (fread(header, sizeof(int32_t), 6, f) != 6 || header[0] != NN_MAGIC || header[1] != NN_VERSION
+        || header[2] != NN_INPUT_PLANES || header[3] <= 0 || header[3] % NN_CHANNEL_BLOCK != 0
+        || header[4] < 0 || header[5] <= 0) {
+        printf("%s is not a weight file this version can read.\n", path);
+        fclose(f);
+        return 0;
+    }
+    nn_alloc(net, header[3], header[4], header[5]);
+    float **tensors = (float**)malloc(NN_MAX_TENSORS(net->n_blocks) * sizeof(float*));
+    size_t *sizes = (size_t*)malloc(NN_MAX_TENSORS(net->n_blocks) * sizeof(size_t));
+    int n_tensors = nn_tensors(net, tensors, sizes);
+    int is_ok = 1;
+    for (int i = 0; i < n_tensors && is_ok; ++i) {
+        is_ok = fread(tensors[i], sizeof(float), sizes[i], f) == sizes[i];
+    }
+    free(tensors);
+    free(sizes);
+    fclose(f);
+    if (!is_ok) {
+        printf("The weight file %s is truncated.\n", path);
+        nn_free(net);
+        return 0;
+    }
+    return 1;
+}
+
+// Write a network to a weight file that nn_load reads, return 1 on success
+int nn_save(NeuralNet *net, const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        printf("Cannot create the weight file %s.\n", path);
+        return 0;
+    }
+    int32_t header[6] = {NN_MAGIC, NN_VERSION, NN_INPUT_PLANES, net->channels, net->n_blocks, net->value_hidden};
+    int is_ok = fwrite(header, sizeof(int32_t), 6, f) == 6;
+    float **tensors = (float**)malloc(NN_MAX_TENSORS(net->n_blocks) * sizeof(float*));
+    size_t *sizes = (size_t*)malloc(NN_MAX_TENSORS(net->n_blocks) * sizeof(size_t));
+    int n_tensors = nn_tensors(net, tensors, sizes);
+    for (int i = 0; i < n_tensors && is_ok; ++i) {
+        is_ok = fwrite(tensors[i], sizeof(float), sizes[i], f) == sizes[i];
+    }
+    free(tensors);
+    free(sizes);
+    is_ok = fclose(f) == 0 && is_ok;
+    if (!is_ok) {
+        printf("Cannot write the weight file %s.\n", path);
+    }
+    return is_ok;
+}
+
+// Fill a network with random weights scaled to the fan-in of each layer, for testing and benchmarks
+// channels must be a multiple of NN_CHANNEL_BLOCK
+void nn_init_random(NeuralNet *net, int channels, int n_blocks, int value_hidden, uint64_t seed) {
+    nn_alloc(net, channels, n_blocks, value_hidden);
+    float **tensors = (float**)malloc(NN_MAX_TENSORS(n_blocks) * sizeof(float*));
+    size_t *sizes = (size_t*)malloc(NN_MAX_TENSORS(n_blocks) * sizeof(size_t));
+    int n_tensors = nn_tensors(net, tensors, sizes);
+    uint64_t state = seed;
+    for (int i = 0; i < n_tensors; ++i) {
+        // The tensors come in pairs of weights and biases, and a layer's fan-in is its weights per bias
+        int is_bias = i % 2 == 1;
+        float range = is_bias ? 0.01f : sqrtf(3.0f / (float)(sizes[i] / sizes[i + 1]));
+        for (size_t j = 0; j < sizes[i]; ++j) {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            float u = (float)(state >> 40) / (float)(1 << 24);
+            tensors[i][j] = (2.0f * u - 1.0f) * range;
+        }
+    }
+    free(tensors);
+    free(sizes);
+}
+
+// Convert the convolution weights to int8 with one scale per output channel
+void nn_conv_quantize(NNConv *conv) {
+    int cin = conv->in_channels, cout = conv->out_channels;
+    free(conv->qweights);
+    free(conv->qscales);
+    conv->qweights = (int8_t*)malloc((size_t)9 * cin * cout);
+    conv->qscales = (float*)malloc(cout * sizeof(float));
+    for (int co = 0; co < cout; ++co) {
+        float max_abs = 0;
+        for (int i = 0; i < 9 * cin; ++i) {
+            float w = fabsf(conv->weights[(size_t)i * cout + co]);
+            max_abs = w > max_abs ? w : max_abs;
+        }
+        float scale = max_abs > 0 ? max_abs / 127.0f : 1.0f;
+        conv->qscales[co] = scale;
+        for (int tap = 0; tap < 9; ++tap) {
+            for (int ci = 0; ci < cin; ++ci) {
+                float w = conv->weights[((size_t)tap * cin + ci) * cout + co];
+                conv->qweights[(((size_t)tap * (cin / 4) + ci / 4) * cout + co) * 4 + ci % 4] = (int8_t)lrintf(w / scale);
+            }
+        }
+    }
+}
+
+// Run the convolutions of the network on int8 weights from now on
+// It is several times faster on AVX2, at the cost of a little accuracy
+void nn_quantize(NeuralNet *net) {
+    nn_conv_quantize(&net->stem);
+    for (int i = 0; i < 2 * net->n_blocks; ++i) {
+        nn_conv_quantize(&net->convs[i]);
+    }
+    net->is_quantized = 1;
+}
+
+// Write ReLU(value + residual) to out at index, residual may be NULL, and it may be out itself
+void nn_store_scalar(float value, float *out, const float *residual, size_t index) {
+    if (residual != NULL) {
+        value += residual[index];
+    }
+    out[index] = value > 0 ? value : 0;
+}
+
+// The vector kernels run over the squares of a padded tensor as one sequence, from the first square
+// on the board to the last, four at a time. The border squares in between are computed but not
+// stored, so rows need not be a multiple of four long, and the last block may read this many
+// squares past the end of the padded tensor
+#define NN_SQUARES_SLACK 4
+
+// Return 1 if the square at index i of a padded tensor is on the board and not in the border
+int nn_is_on_board(int i, int width, int height) {
+    int stride = width + 2;
+    int x = i % stride, y = i / stride;
+    return x >= 1 && x <= width && y >= 1 && y <= height;
+}
+
+// Apply a 3x3 convolution to the padded tensor in, then add residual if it is not NULL and apply ReLU
+// in and out are padded tensors of width x height squares; out may be the residual but not in
+void nn_conv3x3(const NNConv *conv, const float *in, float *out, const float *residual, int width, int height) {
+    int cin = conv->in_channels, cout = conv->out_channels;
+    int stride = width + 2;
+#if defined(__AVX2__) && defined(__FMA__)
+    // Four squares and 16 output channels at a time, which fills 8 registers with sums
+    int first = stride + 1, last = height * stride + width;
+    for (int i = first; i <= last; i += 4) {
+        for (int co = 0; co < cout; co += NN_CHANNEL_BLOCK) {
+            // The squares are written out one by one so the sums stay in registers without -O3
+            __m256 sum[4][2];
+            __m256 b0 = _mm256_loadu_ps(conv->bias + co), b1 = _mm256_loadu_ps(conv->bias + co + 8);
+            __m256 s00 = b0, s01 = b1, s10 = b0, s11 = b1, s20 = b0, s21 = b1, s30 = b0, s31 = b1;
+            for (int tap = 0; tap < 9; ++tap) {
+                const float *src = in + (size_t)(i + (tap / 3 - 1) * stride + tap % 3 - 1) * cin;
+                const float *w = conv->weights + (size_t)tap * cin * cout + co;
+                for (int ci = 0; ci < cin; ++ci) {
+                    __m256 w0 = _mm256_loadu_ps(w + (size_t)ci * cout);
+                    __m256 w1 = _mm256_loadu_ps(w + (size_t)ci * cout + 8);
+                    __m256 a0 = _mm256_broadcast_ss(src + ci);
+                    __m256 a1 = _mm256_broadcast_ss(src + cin + ci);
+                    __m256 a2 = _mm256_broadcast_ss(src + 2 * cin + ci);
+                    __m256 a3 = _mm256_broadcast_ss(src + 3 * cin + ci);
+                    s00 = _mm256_fmadd_ps(a0, w0, s00);
+                    s01 = _mm256_fmadd_ps(a0, w1, s01);
+                    s10 = _mm256_fmadd_ps(a1, w0, s10);
+                    s11 = _mm256_fmadd_ps(a1, w1, s11);
+                    s20 = _mm256_fmadd_ps(a2, w0, s20);
+                    s21 = _mm256_fmadd_ps(a2, w1, s21);
+                    s30 = _mm256_fmadd_ps(a3, w0, s30);
+                    s31 = _mm256_fmadd_ps(a3, w1, s31);
+                }
+            }
+            sum[0][0] = s00, sum[0][1] = s01, sum[1][0] = s10, sum[1][1] = s11;
+            sum[2][0] = s20, sum[2][1] = s21, sum[3][0] = s30, sum[3][1] = s31;
+            for (int p = 0; p < 4; ++p) {
+                if (!nn_is_on_board(i + p, width, height)) {
+                    continue;
+                }
+                size_t index = (size_t)(i + p) * cout + co;
+                for (int h = 0; h < 2; ++h) {
+                    __m256 v = sum[p][h];
+                    if (residual != NULL) {
+                        v = _mm256_add_ps(v, _mm256_loadu_ps(residual + index + 8 * h));
+                    }
+                    _mm256_storeu_ps(out + index + 8 * h, _mm256_max_ps(v, _mm256_setzero_ps()));
+                }
+            }
+        }
+    }
+#else
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            for (int co = 0; co < cout; ++co) {
+                float sum = conv->bias[co];
+                for (int tap = 0; tap < 9; ++tap) {
+                    const float *src = in + ((size_t)(y + tap / 3) * stride + x + tap % 3) * cin;
+                    const float *w = conv->weights + (size_t)tap * cin * cout + co;
+                    for (int ci = 0; ci < cin; ++ci) {
+                        sum += src[ci] * w[(size_t)ci * cout];
+                    }
+                }
+                nn_store_scalar(sum, out, residual, ((size_t)(y + 1) * stride + x + 1) * cout + co);
+            }
+        }
+    }
+#endif
+}
+
+// Quantize the squares of a padded tensor of ReLU outputs to 0 .. 127, and return the scale
+// Keeping to 7 bits means a pair of products in _mm256_maddubs_epi16 cannot saturate
+float nn_quantize_activations(const float *in, uint8_t *q, int channels, int width, int height) {
+    int stride = width + 2;
+    int n = width * channels; // The values of one row of the board
+    float max_value = 0;
+    for (int y = 1; y <= height; ++y) {
+        const float *row = in + ((size_t)y * stride + 1) * channels;
+        int i = 0;
+#if defined(__AVX2__)
+        __m256 row_max = _mm256_setzero_ps();
+        for (; i + 8 <= n; i += 8) {
+            row_max = _mm256_max_ps(row_max, _mm256_loadu_ps(row + i));
+        }
+        float maxes[8];
+        _mm256_storeu_ps(maxes, row_max);
+        for (int j = 0; j < 8; ++j) {
+            max_value = maxes[j] > max_value ? maxes[j] : max_value;
+        }
+#endif
+        for (; i < n; ++i) {
+            max_value = row[i] > max_value ? row[i] : max_value;
+        }
+    }
+    float scale = max_value > 0 ? max_value / 127.0f : 1.0f;
+    float inverse = 1.0f / scale;
+    for (int y = 1; y <= height; ++y) {
+        size_t start = ((size_t)y * stride + 1) * channels;
+        int i = 0;
+#if defined(__AVX2__)
+        // Round 16 values to 32 bit integers, then pack them to bytes in order
+        __m256 v_inverse = _mm256_set1_ps(inverse), half = _mm256_set1_ps(0.5f);
+        for (; i + 16 <= n; i += 16) {
+            __m256i lo = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(in + start + i), v_inverse), half));
+            __m256i hi = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(in + start + i + 8), v_inverse), half));
+            __m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+            __m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+            _mm_storeu_si128((__m128i*)(q + start + i), bytes);
+        }
+#endif
+        for (; i < n; ++i) {
+            q[start + i] = (uint8_t)(in[start + i] * inverse + 0.5f);
+        }
+    }
+    return scale;
+}
+
+#if defined(__AVX2__)
+// Add the four products of unsigned a and signed w in each 32 bit lane to sum, in one instruction with VNNI
+__m256i nn_dot_u8_s8(__m256i sum, __m256i a, __m256i w) {
+#if defined(__AVXVNNI__)
+    return _mm256_dpbusd_avx_epi32(sum, a, w);
+#elif defined(__AVX512VNNI__) && defined(__AVX512VL__)
+    return _mm256_dpbusd_epi32(sum, a, w);
+#else
+    return _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_maddubs_epi16(a, w), _mm256_set1_epi16(1)));
+#endif
+}
+#endif
+
+// nn_conv3x3 on int8 weights, with the input quantized to q with scale in_scale
+// The products are summed in 32 bit integers and scaled back to floats before the bias
+void nn_conv3x3_int8(const NNConv *conv, const uint8_t *q, float in_scale, float *out, const float *residual,
+                     int width, int height) {
+    int cin = conv->in_channels, cout = conv->out_channels;
+    int cin4 = cin / 4;
+    int stride = width + 2;
+#if defined(__AVX2__)
+    // Four squares and 16 output channels at a time, as in nn_conv3x3; each 32 bit lane of the weights
+    // holds four input channels of one output channel, which nn_dot_u8_s8 sums
+    int first = stride + 1, last = height * stride + width;
+    for (int i = first; i <= last; i += 4) {
+        for (int co = 0; co < cout; co += NN_CHANNEL_BLOCK) {
+            __m256i sum[4][2];
+            __m256i s00, s01, s10, s11, s20, s21, s30, s31;
+            s00 = s01 = s10 = s11 = s20 = s21 = s30 = s31 = _mm256_setzero_si256();
+            for (int tap = 0; tap < 9; ++tap) {
+                const uint8_t *src = q + (size_t)(i + (tap / 3 - 1) * stride + tap % 3 - 1) * cin;
+                const int8_t *w = conv->qweights + ((size_t)tap * cin4 * cout + co) * 4;
+                for (int c4 = 0; c4 < cin4; ++c4) {
+                    __m256i w0 = _mm256_loadu_si256((const __m256i*)(w + (size_t)c4 * cout * 4));
+                    __m256i w1 = _mm256_loadu_si256((const __m256i*)(w + (size_t)c4 * cout * 4 + 32));
+                    int32_t four[4];
+                    for (int p = 0; p < 4; ++p) {
+                        memcpy(&four[p], src + p * cin + c4 * 4, sizeof(int32_t));
+                    }
+                    __m256i a0 = _mm256_set1_epi32(four[0]);
+                    __m256i a1 = _mm256_set1_epi32(four[1]);
+                    __m256i a2 = _mm256_set1_epi32(four[2]);
+                    __m256i a3 = _mm256_set1_epi32(four[3]);
+                    s00 = nn_dot_u8_s8(s00, a0, w0);
+                    s01 = nn_dot_u8_s8(s01, a0, w1);
+                    s10 = nn_dot_u8_s8(s10, a1, w0);
+                    s11 = nn_dot_u8_s8(s11, a1, w1);
+                    s20 = nn_dot_u8_s8(s20, a2, w0);
+                    s21 = nn_dot_u8_s8(s21, a2, w1);
+                    s30 = nn_dot_u8_s8(s30, a3, w0);
+                    s31 = nn_dot_u8_s8(s31, a3, w1);
+                }
+            }
+            sum[0][0] = s00, sum[0][1] = s01, sum[1][0] = s10, sum[1][1] = s11;
+            sum[2][0] = s20, sum[2][1] = s21, sum[3][0] = s30, sum[3][1] = s31;
+            __m256 scale[2], bias[2];
+            for (int h = 0; h < 2; ++h) {
+                scale[h] = _mm256_mul_ps(_mm256_set1_ps(in_scale), _mm256_loadu_ps(conv->qscales + co + 8 * h));
+                bias[h] = _mm256_loadu_ps(conv->bias + co + 8 * h);
+            }
+            for (int p = 0; p < 4; ++p) {
+                if (!nn_is_on_board(i + p, width, height)) {
+                    continue;
+                }
+                size_t index = (size_t)(i + p) * cout + co;
+                for (int h = 0; h < 2; ++h) {
+                    __m256 v = _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(sum[p][h]), scale[h]), bias[h]);
+                    if (residual != NULL) {
+                        v = _mm256_add_ps(v, _mm256_loadu_ps(residual + index + 8 * h));
+                    }
+                    _mm256_storeu_ps(out + index + 8 * h, _mm256_max_ps(v, _mm256_setzero_ps()));
+                }
+            }
+        }
+    }
+#else
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            for (int co = 0; co < cout; ++co) {
+                int32_t sum = 0;
+                for (int tap = 0; tap < 9; ++tap) {
+                    const uint8_t *src = q + ((size_t)(y + tap / 3) * stride + x + tap % 3) * cin;
+                    const int8_t *w = conv->qweights + ((size_t)tap * cin4 * cout + co) * 4;
+                    for (int ci = 0; ci < cin; ++ci) {
+                        sum += (int32_t)src[ci] * w[(size_t)(ci / 4) * cout * 4 + ci % 4];
+                    }
+                }
+                float value = (float)sum * in_scale * conv->qscales[co] + conv->bias[co];
+                nn_store_scalar(value, out, residual, ((size_t)(y + 1) * stride + x + 1) * cout + co);
+            }
+        }
+    }
+#endif
+}
+
+// The scratch tensors of one forward pass, sized for a board
+typedef struct nnWorkspace {
+    struct nnWorkspace *next; // The next free workspace of an NNEvaluator
+    int width;
+    int height;
+    float *planes; // The padded input planes
+    float *x; // The padded output of the stem and of each residual block
+    float *t; // The padded output of the first convolution of a block
+    uint8_t *q_planes; // The quantized input planes
+    uint8_t *q; // The quantized input of the other convolutions
+    float *logits; // One per square
+    float *means; // The mean of each channel over the board
+} NNWorkspace;
+
+// Define the NNEvaluator struct, the data nn_evaluate is called with
+// Each call takes a workspace from the free list and puts it back when done, so the threads
+// evaluating at the same time each have their own, and none is allocated again once the list
+// holds one per thread
+typedef struct {
+    NeuralNet *net;
+    pthread_mutex_t lock; // Guards free_list
+    NNWorkspace *free_list;
+} NNEvaluator;
+
+void nn_evaluator_init(NNEvaluator *evaluator, NeuralNet *net) {
+    evaluator->net = net;
+    pthread_mutex_init(&evaluator->lock, NULL);
+    evaluator->free_list = NULL;
+}
+
+void nn_workspace_init(NNWorkspace *ws, NeuralNet *net, int width, int height) {
+    size_t squares = (size_t)(width + 2) * (height + 2) + NN_SQUARES_SLACK;
+    ws->width = width;
+    ws->height = height;
+    // The borders are never written, so they stay zero
+    ws->planes = (float*)calloc(squares * NN_INPUT_PLANES, sizeof(float));
+    ws->x = (float*)calloc(squares * net->channels, sizeof(float));
+    ws->t = (float*)calloc(squares * net->channels, sizeof(float));
+    ws->q_planes = (uint8_t*)calloc(squares * NN_INPUT_PLANES, sizeof(uint8_t));
+    ws->q = (uint8_t*)calloc(squares * net->channels, sizeof(uint8_t));
+    ws->logits = (float*)malloc((size_t)width * height * sizeof(float));
+    ws->means = (float*)malloc(net->channels * sizeof(float));
+}
+
+void nn_workspace_free(NNWorkspace *ws) {
+    free(ws->planes);
+    free(ws->x);
+    free(ws->t);
+    free(ws->q_planes);
+    free(ws->q);
+    free(ws->logits);
+    free(ws->means);
+}
+
+// Free the workspaces of the evaluator, the network is not owned by it
+void nn_evaluator_free(NNEvaluator *evaluator) {
+    while (evaluator->free_list != NULL) {
+        NNWorkspace *next = evaluator->free_list->next;
+        nn_workspace_free(evaluator->free_list);
+        free(evaluator->free_list);
+        evaluator->free_list = next;
+    }
+    pthread_mutex_destroy(&evaluator->lock);
+}
+
+// Take a free workspace from the evaluator, or allocate one if all are in use
+NNWorkspace *nn_evaluator_take_workspace(NNEvaluator *evaluator) {
+    pthread_mutex_lock(&evaluator->lock);
+    NNWorkspace *ws = evaluator->free_list;
+    if (ws != NULL) {
+        evaluator->free_list = ws->next;
+    }
+    pthread_mutex_unlock(&evaluator->lock);
+    if (ws == NULL) {
+        ws = (NNWorkspace*)malloc(sizeof(NNWorkspace));
+        if (ws == NULL) {
+            printf("Out of memory allocating a network workspace.\n");
+            exit(1);
+        }
+        ws->width = -1;
+    }
+    return ws;
+}
+
+void nn_evaluator_return_workspace(NNEvaluator *evaluator, NNWorkspace *ws) {
+    pthread_mutex_lock(&evaluator->lock);
+    ws->next = evaluator->free_list;
+    evaluator->free_list = ws;
+    pthread_mutex_unlock(&evaluator->lock);
+}
+
+// Apply one convolution of the network, in floats or in int8 with q holding the quantized input
+void nn_apply_conv(NeuralNet *net, NNWorkspace *ws, const NNConv *conv, const float *in, uint8_t *q, float *out,
+                   const float *residual) {
+    if (net->is_quantized) {
+        float scale = nn_quantize_activations(in, q, conv->in_channels, ws->width, ws->height);
+        nn_conv3x3_int8(conv, q, scale, out, residual, ws->width, ws->height);
+    } else {
+        nn_conv3x3(conv, in, out, residual, ws->width, ws->height);
+    }
+}
+
+// Write the input planes of the position b, seen by the player to move
+void nn_encode(Board *b, NNWorkspace *ws) {
+    int stride = b->width + 2;
+    int player = b->current_player;
+    for (int y = 0; y < b->height; ++y) {
+        for (int x = 0; x < b->width; ++x) {
+            float *square = ws->planes + ((size_t)(y + 1) * stride + x + 1) * NN_INPUT_PLANES;
+            int state = board_get_state(b, x, y);
+            square[0] = state == player;
+            square[1] = state == 1 - player;
+            square[2] = b->last_move == y * b->width + x;
+            square[3] = 1;
+        }
+    }
+}
+
+// Run the network on the position b, filling ws->logits with one policy logit per move
+// and returning the value from the perspective of the player to move
+double nn_forward(NeuralNet *net, NNWorkspace *ws, Board *b) {
+    int c = net->channels;
+    int stride = b->width + 2;
+    nn_encode(b, ws);
+    nn_apply_conv(net, ws, &net->stem, ws->planes, ws->q_planes, ws->x, NULL);
+    for (int i = 0; i < net->n_blocks; ++i) {
+        nn_apply_conv(net, ws, &net->convs[2 * i], ws->x, ws->q, ws->t, NULL);
+        nn_apply_conv(net, ws, &net->convs[2 * i + 1], ws->t, ws->q, ws->x, ws->x);
+    }
+
+    // The policy logit of each square, and the mean of every channel for the value head
+    float *means = ws->means;
+    for (int k = 0; k < c; ++k) {
+        means[k] = 0;
+    }
+    for (int y = 0; y < b->height; ++y) {
+        for (int x = 0; x < b->width; ++x) {
+            const float *square = ws->x + ((size_t)(y + 1) * stride + x + 1) * c;
+            float logit = net->policy_bias[0];
+            for (int k = 0; k < c; ++k) {
+                logit += square[k] * net->policy_weights[k];
+                means[k] += square[k];
+            }
+            ws->logits[y * b->width + x] = logit;
+        }
+    }
+    float inverse_squares = 1.0f / (float)(b->width * b->height);
+    float value = net->value_bias2[0];
+    for (int j = 0; j < net->value_hidden; ++j) {
+        float h = net->value_bias1[j];
+        for (int k = 0; k < c; ++k) {
+            h += means[k] * inverse_squares * net->value_weights1[(size_t)k * net->value_hidden + j];
+        }
+        value += (h > 0 ? h : 0) * net->value_weights2[j];
+    }
+    return tanh(value);
+}
+
+// An evaluator for mcts_set_evaluator, with data pointing to an NNEvaluator
+// Every move available gets a prior from the softmax of the policy logits, leaving out moves
+// forbidden to the player to move, and the value head scores the position
+// One workspace serves the whole batch; the network is only read, so threads may share it
+void nn_evaluate(void *data, Board **boards, int n_boards, EvaluatorResult *results, uint64_t *rng) {
+    NNEvaluator *evaluator = (NNEvaluator*)data;
+    NeuralNet *net = evaluator->net;
+    (void)rng;
+    NNWorkspace *ws = nn_evaluator_take_workspace(evaluator);
+    for (int i = 0; i < n_boards; ++i) {
+        Board *b = boards[i];
+        EvaluatorResult *result = &results[i];
+        // A workspace is only resized when the board size changes
+        if (ws->width != b->width || ws->height != b->height) {
+            if (ws->width != -1) {
+                nn_workspace_free(ws);
+            }
+            nn_workspace_init(ws, net, b->width, b->height);
+        }
+        result->value = nn_forward(net, ws, b);
+        result->weight = 1;
+
+        int is_restricted = board_is_restricted(b, b->current_player);
+        int count = 0;
+        for (int j = 0; j < b->moves_available_count; ++j) {
+            int move = b->moves_available[j];
+            if (!is_restricted || !board_check_forbidden(b, move)) {
+                result->actions[count++] = move;
+            }
+        }
+        if (count == 0) {
+            // Every move is forbidden, so one has to be played anyway
+            for (int j = 0; j < b->moves_available_count; ++j) {
+                result->actions[count++] = b->moves_available[j];
+            }
+        }
+        result->actions_count = count;
+        float max_logit = -INFINITY;
+        for (int j = 0; j < count; ++j) {
+            float logit = ws->logits[result->actions[j]];
+            max_logit = logit > max_logit ? logit : max_logit;
+        }
+        double total = 0;
+        for (int j = 0; j < count; ++j) {
+            result->priors[j] = exp(ws->logits[result->actions[j]] - max_logit);
+            total += result->priors[j];
+        }
+        for (int j = 0; j < count; ++j) {
+            result->priors[j] /= total;
+        }
+    }
+    nn_evaluator_return_workspace(evaluator, ws);
+}
+
+// Measure how many positions per second nn_evaluate scores on size x size boards in batches of batch_size
+// The positions are size random moves into a game, so the timing does not depend on a search
+// A first batch sizes the workspace before the clock starts
+double nn_benchmark(NeuralNet *net, int size, int batch_size, int n_batches) {
+    NNEvaluator evaluator;
+    nn_evaluator_init(&evaluator, net);
+    Board *boards = (Board*)malloc(batch_size * sizeof(Board));
+    Board **pointers = (Board**)malloc(batch_size * sizeof(Board*));
+    EvaluatorResult *results = (EvaluatorResult*)malloc(batch_size * sizeof(EvaluatorResult));
+    uint64_t rng = 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < batch_size; ++i) {
+        board_init(&boards[i], 0, size, size, 5);
+        for (int j = 0; j < size; ++j) {
+            rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+            board_do_move(&boards[i], boards[i].moves_available[(rng >> 33) % boards[i].moves_available_count]);
+        }
+        pointers[i] = &boards[i];
+    }
+    nn_evaluate(&evaluator, pointers, batch_size, results, &rng);
+    uint64_t start_ns = timer_now_ns();
+    for (int i = 0; i < n_batches; ++i) {
+        nn_evaluate(&evaluator, pointers, batch_size, results, &rng);
+    }
+    double seconds = (double)(timer_now_ns() - start_ns) * 1e-9;
+    nn_evaluator_free(&evaluator);
+    for (int i = 0; i < batch_size; ++i) {
+        board_free(&boards[i]);
+    }
+    free(boards);
+    free(pointers);
+    free(results);
+    return (double)batch_size * n_batches / seconds;
+}
+
+#endif //GOMOKU_MCTS_C_NN_H
@@ -0,0 +1,581 @@
+//
+// Created by diex on 10/17/2026.
+//
+
+#ifndef GOMOKU_MCTS_C_RECORD_H
+#define GOMOKU_MCTS_C_RECORD_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "board.h"
+#include "lz.h"
+
+// The self-play record file
+// It starts with RECORD_MAGIC and RECORD_VERSION as 32 bit little endian integers, followed by blocks.
+// A block is its raw size and its compressed size as 32 bit little endian integers, then the
+// compressed bytes, or the raw bytes if the compressed size is 0. Blocks hold whole games, so a file
+// can be appended to by later runs and read up to its last complete block.
+// A game is a list of unsigned LEB128 varints: width, height, n_in_row, rule, start player,
+// winner + 1 and the number of moves, then for each move the move played, the number of moves the
+// search visited, and those moves in increasing order, each as the gap from the one before and its
+// root visit count.
+
+#define RECORD_MAGIC 0x50534D47 // "GMSP"
+#define RECORD_VERSION 1
+// Games are gathered into blocks of about this many bytes before they are compressed
+#define RECORD_BLOCK_SIZE (64 * 1024)
+// The largest encoded game: every varint at its 5 byte maximum, and every position visiting every square
+#define RECORD_MAX_GAME_SIZE (7 * 5 + BOARD_MAX_CELLS * (2 * 5 + BOARD_MAX_CELLS * 2 * 5))
+// The largest block a writer produces: a full block, or a game too large for one written alone
+#define RECORD_MAX_BLOCK_SIZE (RECORD_MAX_GAME_SIZE > RECORD_BLOCK_SIZE ? RECORD_MAX_GAME_SIZE : RECORD_BLOCK_SIZE)
+
+// A growable array of bytes
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+} RecordBuffer;
+
+void record_buffer_init(RecordBuffer *buffer) {
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->capacity = 0;
+}
+
+void record_buffer_free(RecordBuffer *buffer) {
+    free(buffer->data);
+    record_buffer_init(buffer);
+}
+
+// Make room for size bytes in all
+void record_buffer_reserve(RecordBuffer *buffer, size_t size) {
+    if (size <= buffer->capacity) {
+        return;
+    }
+    size_t capacity = buffer->capacity > 0 ? buffer->capacity : 256;
+    while (capacity < size) {
+        capacity *= 2;
+    }
+    buffer->data = (uint8_t*)realloc(buffer->data, capacity);
+    if (buffer->data == NULL) {
+        printf("Out of memory growing a record buffer to %zu bytes.\n", capacity);
+        exit(1);
+    }
+    buffer->capacity = capacity;
+}
+
+void record_buffer_append(RecordBuffer *buffer, const uint8_t *data, size_t size) {
+    record_buffer_reserve(buffer, buffer->size + size);
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+}
+
+void record_buffer_put_varint(RecordBuffer *buffer, uint32_t value) {
+    record_buffer_reserve(buffer, buffer->size + 5);
+    while (value >= 0x80) {
+        buffer->data[buffer->size++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    buffer->data[buffer->size++] = (uint8_t)value;
+}
+
+// Read a varint at *pos from the size bytes of data, return 0 if it runs past the end
+int record_get_varint(const uint8_t *data, size_t size, size_t *pos, int *value) {
+    uint32_t result = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (*pos >= size) {
+            return 0;
+        }
+        uint8_t byte = data[(*pos)++];
+        result |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = (int)result;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void record_put_u32(uint8_t *p, uint32_t value) {
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
+
+uint32_t record_get_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// Define the record of one game
+// The root visits of every position are kept as a list of (move, visits) entries, one position
+// after another, so a position costs only as much as the moves its search visited
+typedef struct {
+    int width;
+    int height;
+    int n_in_row;
+    int rule;
+    int start_player;
+    int winner; // -1 for a tie
+    int n_moves;
+    int moves[BOARD_MAX_CELLS];
+    int n_entries[BOARD_MAX_CELLS]; // The number of visited moves at each position
+    int *entry_moves;
+    int *entry_visits;
+    int n_total_entries;
+    int entries_capacity;
+} GameRecord;
+
+void game_record_init(GameRecord *record) {
+    record->n_moves = 0;
+    record->winner = -1;
+    record->entry_moves = NULL;
+    record->entry_visits = NULL;
+    record->n_total_entries = 0;
+    record->entries_capacity = 0;
+}
+
+void game_record_free(GameRecord *record) {
+    free(record->entry_moves);
+    free(record->entry_visits);
+    game_record_init(record);
+}
+
+// Start recording a game from the empty board b
+void game_record_start(GameRecord *record, Board *b) {
+    record->width = b->width;
+    record->height = b->height;
+    record->n_in_row = b->n_in_row;
+    record->rule = b->rule;
+    record->start_player = b->black;
+    record->winner = -1;
+    record->n_moves = 0;
+    record->n_total_entries = 0;
+}
+
+// Add an entry for the position being recorded
+void game_record_add_entry(GameRecord *record, int move, int visits) {
+    if (record->n_total_entries == record->entries_capacity) {
+        record->entries_capacity = record->entries_capacity > 0 ? 2 * record->entries_capacity : 1024;
+        record->entry_moves = (int*)realloc(record->entry_moves, record->entries_capacity * sizeof(int));
+        record->entry_visits = (int*)realloc(record->entry_visits, record->entries_capacity * sizeof(int));
+        if (record->entry_moves == NULL || record->entry_visits == NULL) {
+            printf("Out of memory growing a game record.\n");
+            exit(1);
+        }
+    }
+    record->entry_moves[record->n_total_entries] = move;
+    record->entry_visits[record->n_total_entries] = visits;
+    record->n_total_entries++;
+}
+
+// Record a position: the move played from it, and the root visits of the search, indexed by move
+void game_record_add_position(GameRecord *record, int move, const int *visits) {
+    int n_entries = 0;
+    for (int i = 0; i < record->width * record->height; ++i) {
+        if (visits[i] > 0) {
+            game_record_add_entry(record, i, visits[i]);
+            n_entries++;
+        }
+    }
+    record->n_entries[record->n_moves] = n_entries;
+    record->moves[record->n_moves++] = move;
+}
+
+// Append the encoding of a game to buffer
+void game_record_encode(GameRecord *record, RecordBuffer *buffer) {
+    record_buffer_put_varint(buffer, record->width);
+    record_buffer_put_varint(buffer, record->height);
+    record_buffer_put_varint(buffer, record->n_in_row);
+    record_buffer_put_varint(buffer, record->rule);
+    record_buffer_put_varint(buffer, record->start_player);
+    record_buffer_put_varint(buffer, record->winner + 1);
+    record_buffer_put_varint(buffer, record->n_moves);
+    int entry = 0;
+    for (int i = 0; i < record->n_moves; ++i) {
+        record_buffer_put_varint(buffer, record->moves[i]);
+        record_buffer_put_varint(buffer, record->n_entries[i]);
+        int previous = 0;
+        for (int j = 0; j < record->n_entries[i]; ++j, ++entry) {
+            record_buffer_put_varint(buffer, record->entry_moves[entry] - previous);
+            record_buffer_put_varint(buffer, record->entry_visits[entry]);
+            previous = record->entry_moves[entry];
+        }
+    }
+}
+
+// Decode the game at *pos in the size bytes of data, return 0 if it is corrupt
+int game_record_decode(GameRecord *record, const uint8_t *data, size_t size, size_t *pos) {
+    int winner;
+    if (!record_get_varint(data, size, pos, &record->width) || !record_get_varint(data, size, pos, &record->height)
+        || !record_get_varint(data, size, pos, &record->n_in_row) || !record_get_varint(data, size, pos, &record->rule)
+        || !record_get_varint(data, size, pos, &record->start_player) || !record_get_varint(data, size, pos, &winner)
+        || !record_get_varint(data, size, pos, &record->n_moves)) {
+        return 0;
+    }
+    int n_cells = record->width * record->height;
+    if (record->width > BOARD_MAX_SIZE || record->height > BOARD_MAX_SIZE || record->n_moves > n_cells) {
+        return 0;
+    }
+    record->winner = winner - 1;
+    record->n_total_entries = 0;
+    for (int i = 0; i < record->n_moves; ++i) {
+        int n_entries, move = 0;
+        if (!record_get_varint(data, size, pos, &record->moves[i]) || !record_get_varint(data, size, pos, &n_entries)
+            || record->moves[i] >= n_cells || n_entries > n_cells) {
+            return 0;
+        }
+        record->n_entries[i] = n_entries;
+        for (int j = 0; j < n_entries; ++j) {
+            int gap, visits;
+            if (!record_get_varint(data, size, pos, &gap) || !record_get_varint(data, size, pos, &visits)) {
+                return 0;
+            }
+            move += gap;
+            game_record_add_entry(record, move, visits);
+        }
+    }
+    return 1;
+}
+
+// A game waiting in the queue of a RecordWriter
+typedef struct recordChunk {
+    struct recordChunk *next;
+    RecordBuffer data;
+} RecordChunk;
+
+// Define the RecordWriter struct
+// Games are encoded by the threads that play them and queued; one writer thread gathers them into
+// blocks, compresses and writes them, so the players never wait for the disk
+typedef struct {
+    FILE *f;
+    pthread_t thread;
+    pthread_mutex_t lock; // Guards the queue and stop
+    pthread_cond_t ready;
+    RecordChunk *head;
+    RecordChunk *tail;
+    int stop;
+    RecordBuffer block; // The games of the block being filled, only touched by the writer thread
+    RecordBuffer compressed;
+    int is_ok; // 0 once a write has failed
+    long n_games;
+    long n_bytes; // The bytes written to the file by this writer
+} RecordWriter;
+
+// Compress the current block and write it out
+void record_writer_flush(RecordWriter *writer) {
+    if (writer->block.size == 0) {
+        return;
+    }
+    record_buffer_reserve(&writer->compressed, writer->block.size + 8);
+    int compressed_size = lz_compress(writer->block.data, (int)writer->block.size, writer->compressed.data + 8,
+                                      (int)writer->block.size);
+    record_put_u32(writer->compressed.data, (uint32_t)writer->block.size);
+    record_put_u32(writer->compressed.data + 4, (uint32_t)compressed_size);
+    if (compressed_size == 0) {
+        memcpy(writer->compressed.data + 8, writer->block.data, writer->block.size);
+    }
+    size_t size = 8 + (compressed_size > 0 ? (size_t)compressed_size : writer->block.size);
+    // Each block is flushed whole, so a file cut short by a crash still ends with complete blocks
+    if (fwrite(writer->compressed.data, 1, size, writer->f) != size || fflush(writer->f) != 0) {
+        writer->is_ok = 0;
+    }
+    writer->n_bytes += (long)size;
+    writer->block.size = 0;
+}
+
+void *record_writer_thread(void *arg) {
+    RecordWriter *writer = (RecordWriter*)arg;
+    pthread_mutex_lock(&writer->lock);
+    while (1) {
+        while (writer->head == NULL && !writer->stop) {
+            pthread_cond_wait(&writer->ready, &writer->lock);
+        }
+        if (writer->head == NULL) {
+            break;
+        }
+        // Take the whole queue, and write it without holding the lock
+        RecordChunk *chunk = writer->head;
+        writer->head = NULL;
+        writer->tail = NULL;
+        pthread_mutex_unlock(&writer->lock);
+        while (chunk != NULL) {
+            if (writer->block.size > 0 && writer->block.size + chunk->data.size > RECORD_BLOCK_SIZE) {
+                record_writer_flush(writer);
+            }
+            record_buffer_append(&writer->block, chunk->data.data, chunk->data.size);
+            RecordChunk *next = chunk->next;
+            record_buffer_free(&chunk->data);
+            free(chunk);
+            chunk = next;
+        }
+        pthread_mutex_lock(&writer->lock);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    record_writer_flush(writer);
+    return NULL;
+}
+
+// Open path for appending games and start the writer thread, return 1 on success
+// A new file gets the header; an existing one must already be a record file
+int record_writer_open(RecordWriter *writer, const char *path) {
+    uint8_t header[8];
+    FILE *existing = fopen(path, "rb");
+    size_t n_read = 0;
+    if (existing != NULL) {
+        n_read = fread(header, 1, sizeof(header), existing);
+        fclose(existing);
+        if (n_read > 0 && (n_read != sizeof(header) || record_get_u32(header) != RECORD_MAGIC)) {
+            printf("%s exists and is not a record file.\n", path);
+            return 0;
+        }
+    }
+    writer->f = fopen(path, "ab");
+    if (writer->f == NULL) {
+        printf("Cannot open the record file %s.\n", path);
+        return 0;
+    }
+    writer->n_bytes = 0;
+    writer->is_ok = 1;
+    if (n_read == 0) {
+        record_put_u32(header, RECORD_MAGIC);
+        record_put_u32(header + 4, RECORD_VERSION);
+        writer->is_ok = fwrite(header, 1, sizeof(header), writer->f) == sizeof(header);
+        writer->n_bytes = sizeof(header);
+    }
+    writer->head = NULL;
+    writer->tail = NULL;
+    writer->stop = 0;
+    writer->n_games = 0;
+    record_buffer_init(&writer->block);
+    record_buffer_init(&writer->compressed);
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->ready, NULL);
+    pthread_create(&writer->thread, NULL, record_writer_thread, writer);
+    return 1;
+}
+
+// Queue a game to be written; the game is encoded here, and the call never waits for the disk
+void record_writer_add_game(RecordWriter *writer, GameRecord *record) {
+    RecordChunk *chunk = (RecordChunk*)malloc(sizeof(RecordChunk));
+    chunk->next = NULL;
+    record_buffer_init(&chunk->data);
+    game_record_encode(record, &chunk->data);
+    pthread_mutex_lock(&writer->lock);
+    if (writer->tail != NULL) {
+        writer->tail->next = chunk;
+    } else {
+        writer->head = chunk;
+    }
+    writer->tail = chunk;
+    writer->n_games++;
+    pthread_cond_signal(&writer->ready);
+    pthread_mutex_unlock(&writer->lock);
+}
+
+// Write the games still queued, stop the writer thread and close the file, return 1 if every write succeeded
+int record_writer_close(RecordWriter *writer) {
+    pthread_mutex_lock(&writer->lock);
+    writer->stop = 1;
+    pthread_cond_signal(&writer->ready);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+    if (fclose(writer->f) != 0) {
+        writer->is_ok = 0;
+    }
+    record_buffer_free(&writer->block);
+    record_buffer_free(&writer->compressed);
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->ready);
+    if (!writer->is_ok) {
+        printf("Writing the record file failed.\n");
+    }
+    return writer->is_ok;
+}
+
+// Define the RecordReader struct, which reads the games of a record file in order
+typedef struct {
+    FILE *f;
+    RecordBuffer block; // The decompressed block being read
+    size_t pos; // The position of the next game in block
+    RecordBuffer compressed;
+    int is_damaged; // Set once a damaged block or game has stopped the reading
+} RecordReader;
+
+// Open a record file for reading, return 1 on success
+int record_reader_open(RecordReader *reader, const char *path) {
+    uint8_t header[8];
+    reader->f = fopen(path, "rb");
+    if (reader->f == NULL) {
+        printf("Cannot open the record file %s.\n", path);
+        return 0;
+    }
+    if (fread(header, 1, sizeof(header), reader->f) != sizeof(header) || record_get_u32(header) != RECORD_MAGIC
+        || record_get_u32(header + 4) != RECORD_VERSION) {
+        printf("%s is not a record file this version can read.\n", path);
+        fclose(reader->f);
+        return 0;
+    }
+    record_buffer_init(&reader->block);
+    record_buffer_init(&reader->compressed);
+    reader->pos = 0;
+    reader->is_damaged = 0;
+    return 1;
+}
+
+// Read the next block into reader->block, return 0 at the end of the file or at a damaged block
+int record_reader_next_block(RecordReader *reader) {
+    uint8_t header[8];
+    size_t n_read = fread(header, 1, sizeof(header), reader->f);
+    if (n_read != sizeof(header)) {
+        if (n_read > 0) {
+            printf("The record file ends inside a block header.\n");
+            reader->is_damaged = 1;
+        }
+        return 0;
+    }
+    uint32_t raw_size = record_get_u32(header);
+    uint32_t compressed_size = record_get_u32(header + 4);
+    // The sizes come from the file, so they are checked before anything is allocated for them
+    // A block is only stored compressed when that made it smaller
+    if (raw_size > RECORD_MAX_BLOCK_SIZE || compressed_size > raw_size) {
+        printf("A block header of the record file is damaged.\n");
+        reader->is_damaged = 1;
+        return 0;
+    }
+    size_t stored_size = compressed_size > 0 ? compressed_size : raw_size;
+    record_buffer_reserve(&reader->block, raw_size);
+    record_buffer_reserve(&reader->compressed, stored_size);
+    uint8_t *target = compressed_size > 0 ? reader->compressed.data : reader->block.data;
+    if (fread(target, 1, stored_size, reader->f) != stored_size) {
+        printf("The record file ends inside a block.\n");
+        reader->is_damaged = 1;
+        return 0;
+    }
+    if (compressed_size > 0
+        && lz_decompress(reader->compressed.data, (int)compressed_size, reader->block.data, (int)raw_size) != (int)raw_size) {
+        printf("A block of the record file is damaged.\n");
+        reader->is_damaged = 1;
+        return 0;
+    }
+    reader->block.size = raw_size;
+    reader->pos = 0;
+    return 1;
+}
+
+// Read the next game into record, return 0 at the end of the file
+int record_reader_next_game(RecordReader *reader, GameRecord *record) {
+    while (reader->pos >= reader->block.size) {
+        if (!record_reader_next_block(reader)) {
+            return 0;
+        }
+    }
+    if (!game_record_decode(record, reader->block.data, reader->block.size, &reader->pos)) {
+        printf("A game of the record file is damaged.\n");
+        reader->is_damaged = 1;
+        return 0;
+    }
+    return 1;
+}
+
+void record_reader_close(RecordReader *reader) {
+    fclose(reader->f);
+    record_buffer_free(&reader->block);
+    record_buffer_free(&reader->compressed);
+}
+
+// Check one decoded game by replaying it: every move must be legal, every position must have visits
+// that include the move played, and the game must end with its last move and its recorded winner
+// Return the number of problems found, printing each of them
+int game_record_verify(GameRecord *record, long game) {
+    int n_cells = record->width * record->height;
+    if (record->width < record->n_in_row || record->height < record->n_in_row || record->n_in_row < 1) {
+        printf("Game %ld: the board %dx%d cannot hold %d in a row.\n", game, record->width, record->height,
+               record->n_in_row);
+        return 1;
+    }
+    int n_problems = 0;
+    Board b;
+    board_init(&b, record->start_player, record->width, record->height, record->n_in_row);
+    board_set_rule(&b, record->rule);
+    int entry = 0, is_end = 0, winner = -1;
+    for (int i = 0; i < record->n_moves; ++i) {
+        int move = record->moves[i], is_visited = 0, previous = -1;
+        if (is_end || !board_is_empty(&b, move)) {
+            printf("Game %ld: move %d at position %d cannot be played.\n", game, move, i);
+            n_problems++;
+            break;
+        }
+        if (record->n_entries[i] == 0) {
+            printf("Game %ld: position %d has no visits.\n", game, i);
+            n_problems++;
+        }
+        for (int j = 0; j < record->n_entries[i]; ++j, ++entry) {
+            int entry_move = record->entry_moves[entry];
+            if (entry_move <= previous || entry_move >= n_cells || !board_is_empty(&b, entry_move)
+                || record->entry_visits[entry] <= 0) {
+                printf("Game %ld: position %d has %d visits on move %d.\n", game, i, record->entry_visits[entry],
+                       entry_move);
+                n_problems++;
+            }
+            is_visited |= entry_move == move;
+            previous = entry_move;
+        }
+        if (!is_visited) {
+            printf("Game %ld: the move %d played at position %d has no visits.\n", game, move, i);
+            n_problems++;
+        }
+        board_do_move(&b, move);
+        board_check_end(&b, &is_end, &winner);
+    }
+    if (n_problems == 0 && !is_end) {
+        printf("Game %ld: the game is not over after its %d moves.\n", game, record->n_moves);
+        n_problems++;
+    } else if (n_problems == 0 && winner != record->winner) {
+        printf("Game %ld: the moves end with winner %d, not the recorded %d.\n", game, winner, record->winner);
+        n_problems++;
+    }
+    board_free(&b);
+    return n_problems;
+}
+
+// Read every game of the record file at path back and verify it, printing the totals
+// Return 1 if the whole file was read and every game is consistent
+int record_verify_file(const char *path) {
+    RecordReader reader;
+    if (!record_reader_open(&reader, path)) {
+        return 0;
+    }
+    GameRecord record;
+    game_record_init(&record);
+    long n_games = 0, n_positions = 0, n_entries = 0, n_visits = 0, n_problems = 0;
+    int n_wins[3] = {0, 0, 0};
+    while (record_reader_next_game(&reader, &record)) {
+        n_problems += game_record_verify(&record, n_games);
+        n_games++;
+        n_positions += record.n_moves;
+        n_entries += record.n_total_entries;
+        for (int i = 0; i < record.n_total_entries; ++i) {
+            n_visits += record.entry_visits[i];
+        }
+        if (record.winner >= -1 && record.winner <= 1) {
+            n_wins[record.winner + 1]++;
+        }
+    }
+    int is_complete = !reader.is_damaged;
+    game_record_free(&record);
+    record_reader_close(&reader);
+    printf("%s: %ld games, %ld positions, %ld visited moves, %.1f visits per position.\n", path, n_games,
+           n_positions, n_entries, n_positions > 0 ? (double)n_visits / n_positions : 0.0);
+    printf("Player 0 won %d, player 1 won %d, %d ties; %ld problems found.\n", n_wins[1], n_wins[2], n_wins[0],
+           n_problems);
+    if (!is_complete) {
+        printf("A damaged block or game left the rest of the file unread.\n");
+    }
+    return is_complete && n_problems == 0;
+}
+
+#endif //GOMOKU_MCTS_C_RECORD_H
@@ -0,0 +1,81 @@
+//
+// Created by diex on 10/17/2026.
+//
+
+#ifndef GOMOKU_MCTS_C_STATS_H
+#define GOMOKU_MCTS_C_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "timer.h"
+
+// Search instrumentation
+// It is compiled in only when MCTS_STATS is defined (the GOMOKU_SEARCH_STATS CMake option), and then
+// only runs while is_enabled is set, so a build without it pays nothing and one with it pays a branch.
+// Every thread counts into its own SearchStats, which are summed when its search ends.
+
+#ifdef MCTS_STATS
+#define SEARCH_STATS_DO(stats, ...) do { if ((stats)->is_enabled) { __VA_ARGS__; } } while (0)
+#else
+#define SEARCH_STATS_DO(stats, ...) do { } while (0)
+#endif
+
+typedef struct {
+    int is_enabled;
+    uint64_t select_ns; // Descending from the root to the leaves
+    uint64_t expand_ns; // Claiming, end checks, the threat solver and adding edges
+    uint64_t evaluate_ns; // The evaluator calls, rollouts included
+    uint64_t backup_ns; // Propagating values back to the root
+    long n_leaves; // The leaves reached
+    long depth_sum; // The sum of the depths of the leaves below the root
+    long n_new_nodes; // The nodes allocated by selection
+    long n_terminal; // Leaves where the game had ended
+    long n_proven; // Leaves the threat solver proved
+    long n_evaluated; // Leaves scored by the evaluator
+    long n_rollouts; // Rollouts played by the evaluator
+    long rollout_moves; // Moves played by the evaluator's rollouts
+    long n_round_limit; // Rollouts stopped by the round limit before the game ended
+} SearchStats;
+
+void search_stats_init(SearchStats *stats, int is_enabled) {
+    memset(stats, 0, sizeof(SearchStats));
+    stats->is_enabled = is_enabled;
+}
+
+// Add the time since *lap_ns to *phase_ns and start the next lap
+void search_stats_lap(uint64_t *phase_ns, uint64_t *lap_ns) {
+    uint64_t now_ns = timer_now_ns();
+    *phase_ns += now_ns - *lap_ns;
+    *lap_ns = now_ns;
+}
+
+// Add the counts of from to to, which other threads may be adding to at the same time
+void search_stats_merge(SearchStats *to, SearchStats *from) {
+    __atomic_fetch_add(&to->select_ns, from->select_ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&to->expand_ns, from->expand_ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&to->evaluate_ns, from->evaluate_ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&to->backup_ns, from->backup_ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&to->n_leaves, from->n_leaves, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&to->depth_sum, from->depth_sum, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&to->n_new_nodes, from->n_new_nodes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&to->n_terminal, from->n_terminal, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&to->n_proven, from->n_proven, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&to->n_evaluated, from->n_evaluated, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&to->n_rollouts, from->n_rollouts, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&to->rollout_moves, from->rollout_moves, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&to->n_round_limit, from->n_round_limit, __ATOMIC_RELAXED);
+}
+
+// Write the counts into buffer as the members of a JSON object, without the braces
+void search_stats_format(SearchStats *stats, char *buffer, size_t size) {
+    snprintf(buffer, size, "\"select_ms\":%.3f,\"expand_ms\":%.3f,\"evaluate_ms\":%.3f,\"backup_ms\":%.3f,"
+                           "\"leaves\":%ld,\"avg_depth\":%.2f,\"new_nodes\":%ld,\"terminal_hits\":%ld,"
+                           "\"solver_proofs\":%ld,\"evaluated\":%ld,\"avg_rollout_length\":%.2f,\"round_limit_hits\":%ld",
+             stats->select_ns * 1e-6, stats->expand_ns * 1e-6, stats->evaluate_ns * 1e-6, stats->backup_ns * 1e-6,
+             stats->n_leaves, stats->n_leaves > 0 ? (double)stats->depth_sum / stats->n_leaves : 0.0,
+             stats->n_new_nodes, stats->n_terminal, stats->n_proven, stats->n_evaluated,
+             stats->n_rollouts > 0 ? (double)stats->rollout_moves / stats->n_rollouts : 0.0, stats->n_round_limit);
+}
+
+#endif //GOMOKU_MCTS_C_STATS_H
@@ -0,0 +1,306 @@
+//
+// Created by diex on 10/17/2026.
+//
+
+#ifndef GOMOKU_MCTS_C_THREAT_H
+#define GOMOKU_MCTS_C_THREAT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "board.h"
+
+// The results of a threat search, from the perspective of the player to move
+#define THREAT_UNKNOWN 0
+#define THREAT_WIN 1
+#define THREAT_LOSS -1
+
+// Define the state of one threat space search
+// The attacker is the player to move at the start. It only plays threats: fours in a
+// VCF (victory by continuous fours), and open threes as well in a VCT (victory by
+// continuous threats). The defender answers every threat with all the moves that can stop it.
+typedef struct {
+    Board *b;
+    int attacker;
+    int use_vct;
+    int max_nodes;
+    int n_nodes;
+    int n_moves; // The number of moves the search has on the board
+    int best_move; // The first move of the winning line found
+} ThreatSearch;
+
+// Return 1 if some window of n_in_row squares through the empty square move holds exactly
+// need stones of player and none of the opponent
+// With need = n_in_row - 2, playing move makes a four; with need = n_in_row - 3, a three
+int threat_has_window(Board *b, int player, int move, int need) {
+    int x, y, pos, lo, hi;
+    int n = b->n_in_row;
+    board_move_to_location(b, move, &x, &y);
+    for (int dir = 0; dir < BOARD_DIRECTIONS; ++dir) {
+        BoardLine own = board_get_line(b, player, dir, x, y, &pos, &lo, &hi);
+        BoardLine opp = board_get_line(b, 1 - player, dir, x, y, &pos, &lo, &hi);
+        int from = pos - n + 1 > lo ? pos - n + 1 : lo;
+        for (int start = from; start <= pos && start + n - 1 <= hi; ++start) {
+            BoardLine window = (BoardLine)((((uint64_t)1 << n) - 1) << start);
+            if (!(opp & window) && __builtin_popcount(own & window) == need) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Collect every empty square that lies in a window of n_in_row squares holding exactly need
+// stones of player and none of the opponent, and return how many there are
+// The whole board is scanned one line at a time, so this is much cheaper than testing
+// every empty square with threat_has_window
+int threat_collect_moves(Board *b, int player, int need, int *moves) {
+    unsigned char seen[BOARD_MAX_CELLS] = {0};
+    int n = b->n_in_row;
+    int count = 0;
+    int n_lines[BOARD_DIRECTIONS] = {b->height, b->width, b->width + b->height - 1, b->width + b->height - 1};
+    for (int dir = 0; dir < BOARD_DIRECTIONS; ++dir) {
+        for (int line = 0; line < n_lines[dir]; ++line) {
+            // Find a square (x, y) on the line to address it by
+            int x, y, pos, lo, hi;
+            int first = line - b->height + 1 > 0 ? line - b->height + 1 : 0;
+            switch (dir) {
+                case 0: x = 0; y = line; break;
+                case 1: x = line; y = 0; break;
+                case 2: x = first; y = first - line + b->height - 1; break;
+                default: x = first; y = line - first; break;
+            }
+            BoardLine own = board_get_line(b, player, dir, x, y, &pos, &lo, &hi);
+            if (__builtin_popcount(own) < need) {
+                continue;
+            }
+            BoardLine opp = board_get_line(b, 1 - player, dir, x, y, &pos, &lo, &hi);
+            for (int start = lo; start + n - 1 <= hi; ++start) {
+                BoardLine window = (BoardLine)((((uint64_t)1 << n) - 1) << start);
+                if ((opp & window) || __builtin_popcount(own & window) != need) {
+                    continue;
+                }
+                BoardLine empty = window & ~own;
+                while (empty) {
+                    int move = board_line_move(b, dir, x, y, __builtin_ctz(empty));
+                    empty &= empty - 1;
+                    if (!seen[move]) {
+                        seen[move] = 1;
+                        moves[count++] = move;
+                    }
+                }
+            }
+        }
+    }
+    return count;
+}
+
+// Return 1 if playing the empty square move makes an open three for player: a shape with a
+// square that would then make an open four
+int threat_is_open_three_move(Board *b, int player, int move) {
+    if (b->n_in_row < 4 || !threat_has_window(b, player, move, b->n_in_row - 3)) {
+        return 0;
+    }
+    // Play move for player without changing whose turn it is
+    int current = b->current_player;
+    b->current_player = player;
+    board_do_move(b, move);
+    int neighbors[8 * BOARD_MAX_SIZE];
+    int count = board_get_line_neighbors(b, move, neighbors);
+    int is_three = 0;
+    for (int i = 0; i < count && !is_three; ++i) {
+        is_three = board_is_open_four_move(b, player, neighbors[i]);
+    }
+    board_undo_move(b);
+    b->current_player = current;
+    return is_three;
+}
+
+// Collect the squares where player would make n_in_row now, and return how many there are
+// Under Renju, black's squares that would make an overline do not count
+int threat_find_wins(Board *b, int player, int *wins) {
+    int n_wins = threat_collect_moves(b, player, b->n_in_row - 1, wins);
+    if (!board_is_restricted(b, player)) {
+        return n_wins;
+    }
+    int count = 0;
+    for (int i = 0; i < n_wins; ++i) {
+        if (board_is_winning_move(b, player, wins[i])) {
+            wins[count++] = wins[i];
+        }
+    }
+    return count;
+}
+
+// Remove the moves forbidden to player from a list of moves, and return how many are left
+int threat_remove_forbidden(Board *b, int player, int *moves, int count) {
+    if (!board_is_restricted(b, player)) {
+        return count;
+    }
+    int n_left = 0;
+    for (int i = 0; i < count; ++i) {
+        if (!board_is_forbidden_move(b, player, moves[i])) {
+            moves[n_left++] = moves[i];
+        }
+    }
+    return n_left;
+}
+
+void threat_do_move(ThreatSearch *ts, int move) {
+    board_do_move(ts->b, move);
+    ts->n_moves++;
+}
+
+void threat_undo_move(ThreatSearch *ts) {
+    board_undo_move(ts->b);
+    ts->n_moves--;
+}
+
+int threat_defend(ThreatSearch *ts, int depth, int threat_move);
+
+// The attacker is to move; return 1 if it has a proven win within depth more threats
+int threat_attack(ThreatSearch *ts, int depth) {
+    Board *b = ts->b;
+    int attacker = ts->attacker;
+    if (++ts->n_nodes > ts->max_nodes) {
+        return 0;
+    }
+    int wins[BOARD_MAX_CELLS];
+    if (threat_find_wins(b, attacker, wins) > 0) {
+        if (ts->n_moves == 0) {
+            ts->best_move = wins[0];
+        }
+        return 1;
+    }
+    if (depth <= 0 || b->moves_available_count == 0) {
+        return 0;
+    }
+    // A four of the defender must be blocked, and the block only helps if it is a threat as well
+    int n_defender_wins = threat_find_wins(b, 1 - attacker, wins);
+    if (n_defender_wins >= 2) {
+        return 0;
+    }
+    if (n_defender_wins == 1) {
+        int move = wins[0];
+        if (board_is_forbidden_move(b, attacker, move)) {
+            return 0;
+        }
+        if (!threat_has_window(b, attacker, move, b->n_in_row - 2)
+            && !(ts->use_vct && threat_is_open_three_move(b, attacker, move))) {
+            return 0;
+        }
+        threat_do_move(ts, move);
+        int result = threat_defend(ts, depth - 1, move);
+        threat_undo_move(ts);
+        if (result && ts->n_moves == 0) {
+            ts->best_move = move;
+        }
+        return result;
+    }
+    // Try every four, then every open three for a VCT
+    int threats[BOARD_MAX_CELLS];
+    int n_fours = threat_collect_moves(b, attacker, b->n_in_row - 2, threats);
+    int n_threats = n_fours;
+    if (ts->use_vct && b->n_in_row >= 4) {
+        int threes[BOARD_MAX_CELLS];
+        int n_threes = threat_collect_moves(b, attacker, b->n_in_row - 3, threes);
+        for (int i = 0; i < n_threes; ++i) {
+            if (!threat_has_window(b, attacker, threes[i], b->n_in_row - 2)
+                && threat_is_open_three_move(b, attacker, threes[i])) {
+                threats[n_threats++] = threes[i];
+            }
+        }
+    }
+    n_threats = threat_remove_forbidden(b, attacker, threats, n_threats);
+    for (int i = 0; i < n_threats; ++i) {
+        threat_do_move(ts, threats[i]);
+        int result = threat_defend(ts, depth - 1, threats[i]);
+        threat_undo_move(ts);
+        if (result) {
+            if (ts->n_moves == 0) {
+                ts->best_move = threats[i];
+            }
+            return 1;
+        }
+        if (ts->n_nodes > ts->max_nodes) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+// The defender is to move after the attacker's threat_move; return 1 if every defence loses
+int threat_defend(ThreatSearch *ts, int depth, int threat_move) {
+    Board *b = ts->b;
+    int attacker = ts->attacker;
+    int defender = 1 - attacker;
+    if (++ts->n_nodes > ts->max_nodes) {
+        return 0;
+    }
+    int wins[BOARD_MAX_CELLS];
+    if (threat_find_wins(b, defender, wins) > 0) {
+        return 0;
+    }
+    int n_attacker_wins = threat_find_wins(b, attacker, wins);
+    if (n_attacker_wins >= 2) {
+        return 1;
+    }
+    if (b->moves_available_count == 0) {
+        return 0;
+    }
+    int defences[8 * BOARD_MAX_SIZE + BOARD_MAX_CELLS];
+    int n_defences = 0;
+    if (n_attacker_wins == 1) {
+        // The four has a single answer
+        defences[n_defences++] = wins[0];
+    } else {
+        // An open three is stopped on its own line, or answered with a four that gains a tempo
+        n_defences = board_get_line_neighbors(b, threat_move, defences);
+        n_defences += threat_collect_moves(b, defender, b->n_in_row - 2, defences + n_defences);
+    }
+    // A forbidden defence cannot be played
+    n_defences = threat_remove_forbidden(b, defender, defences, n_defences);
+    for (int i = 0; i < n_defences; ++i) {
+        threat_do_move(ts, defences[i]);
+        int result = threat_attack(ts, depth);
+        threat_undo_move(ts);
+        if (!result) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Search for a forced win of the player to move by continuous fours, and with use_vct by
+// continuous fours and open threes as well
+// max_depth limits the number of attacker threats and max_nodes the size of the whole search
+// Return THREAT_WIN with winning_move set if a win is proven, THREAT_LOSS if the opponent
+// already has two winning squares that cannot both be blocked, and THREAT_UNKNOWN otherwise
+// The board is restored before returning
+int threat_search(Board *b, int max_depth, int max_nodes, int use_vct, int *winning_move) {
+    ThreatSearch ts;
+    ts.b = b;
+    ts.attacker = b->current_player;
+    ts.use_vct = use_vct;
+    ts.max_nodes = max_nodes;
+    ts.n_nodes = 0;
+    ts.n_moves = 0;
+    ts.best_move = -1;
+    int wins[BOARD_MAX_CELLS];
+    if (threat_find_wins(b, ts.attacker, wins) > 0) {
+        *winning_move = wins[0];
+        return THREAT_WIN;
+    }
+    if (threat_find_wins(b, 1 - ts.attacker, wins) >= 2) {
+        return THREAT_LOSS;
+    }
+    // Deepen one threat at a time, so short wins are found before the budget goes on long lines
+    for (int depth = 1; depth <= max_depth && ts.n_nodes <= ts.max_nodes; ++depth) {
+        if (threat_attack(&ts, depth)) {
+            *winning_move = ts.best_move;
+            return THREAT_WIN;
+        }
+    }
+    return THREAT_UNKNOWN;
+}
+
+#endif //GOMOKU_MCTS_C_THREAT_H
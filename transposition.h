@@ -0,0 +1,117 @@
+//
+// Created by diex on 10/17/2026.
+//
+
+#ifndef GOMOKU_MCTS_C_TRANSPOSITION_H
+#define GOMOKU_MCTS_C_TRANSPOSITION_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+// The number of entries that share one hash bucket, four 16 byte entries fill a cache line
+#define TT_BUCKET_SIZE 4
+
+// Define the entry of the transposition table
+// The statistics are packed into data, and check holds key ^ data. An entry that was torn by
+// two threads writing at once fails the check and reads as a miss, so no locks are needed.
+typedef struct {
+    uint64_t check;
+    uint64_t data; // visits in the low 32 bits, the float value sum in the high 32 bits
+} TTEntry;
+
+// Define the TranspositionTable struct
+// A fixed-size hash table of MCTS statistics by position hash. A position's visit count and value
+// sum are the totals of the playouts through it, whatever move order they reached it by, so the
+// value is from the perspective of the player who made the last move.
+typedef struct {
+    TTEntry *entries;
+    size_t n_buckets; // A power of two
+} TranspositionTable;
+
+// Initialize the table with the largest power-of-two number of buckets that fits in memory_bytes
+void tt_init(TranspositionTable *tt, size_t memory_bytes) {
+    size_t bucket_bytes = TT_BUCKET_SIZE * sizeof(TTEntry);
+    size_t n_buckets = 1;
+    while (n_buckets * 2 * bucket_bytes <= memory_bytes) {
+        n_buckets *= 2;
+    }
+    tt->n_buckets = n_buckets;
+    tt->entries = (TTEntry*)calloc(n_buckets * TT_BUCKET_SIZE, sizeof(TTEntry));
+    if (tt->entries == NULL) {
+        printf("Out of memory allocating a %zu byte transposition table.\n", n_buckets * bucket_bytes);
+        exit(1);
+    }
+}
+
+void tt_free(TranspositionTable *tt) {
+    free(tt->entries);
+    tt->entries = NULL;
+    tt->n_buckets = 0;
+}
+
+// Forget every position in the table
+void tt_clear(TranspositionTable *tt) {
+    memset(tt->entries, 0, tt->n_buckets * TT_BUCKET_SIZE * sizeof(TTEntry));
+}
+
+uint64_t tt_pack(int visits, float value_sum) {
+    uint32_t value_bits;
+    memcpy(&value_bits, &value_sum, sizeof(value_bits));
+    return (uint64_t)(uint32_t)visits | (uint64_t)value_bits << 32;
+}
+
+void tt_unpack(uint64_t data, int *visits, float *value_sum) {
+    uint32_t value_bits = (uint32_t)(data >> 32);
+    *visits = (int)(uint32_t)data;
+    memcpy(value_sum, &value_bits, sizeof(value_bits));
+}
+
+// Look up a position, return 1 and its statistics if it is in the table
+int tt_probe(TranspositionTable *tt, uint64_t key, int *visits, float *value_sum) {
+    TTEntry *bucket = &tt->entries[(key & (tt->n_buckets - 1)) * TT_BUCKET_SIZE];
+    for (int i = 0; i < TT_BUCKET_SIZE; ++i) {
+        uint64_t data = __atomic_load_n(&bucket[i].data, __ATOMIC_RELAXED);
+        uint64_t check = __atomic_load_n(&bucket[i].check, __ATOMIC_RELAXED);
+        if ((check ^ data) == key && data != 0) {
+            tt_unpack(data, visits, value_sum);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Add the visits and value sum of playouts through a position to its statistics
+// The position's own entry is updated if it is in the bucket, otherwise the entry with the fewest
+// visits is replaced, so well searched positions stay in the table
+// The entry is read and written without a lock, so an update racing with another one on the same
+// entry may be lost, which only costs the table a few playouts
+void tt_add(TranspositionTable *tt, uint64_t key, int visits, float value_sum) {
+    TTEntry *bucket = &tt->entries[(key & (tt->n_buckets - 1)) * TT_BUCKET_SIZE];
+    int victim = 0;
+    int victim_visits = INT32_MAX;
+    for (int i = 0; i < TT_BUCKET_SIZE; ++i) {
+        uint64_t data = __atomic_load_n(&bucket[i].data, __ATOMIC_RELAXED);
+        uint64_t check = __atomic_load_n(&bucket[i].check, __ATOMIC_RELAXED);
+        if ((check ^ data) == key && data != 0) {
+            int entry_visits;
+            float entry_value_sum;
+            tt_unpack(data, &entry_visits, &entry_value_sum);
+            visits += entry_visits;
+            value_sum += entry_value_sum;
+            victim = i;
+            break;
+        }
+        int entry_visits = (int)(uint32_t)data;
+        if (entry_visits < victim_visits) {
+            victim = i;
+            victim_visits = entry_visits;
+        }
+    }
+    uint64_t data = tt_pack(visits, value_sum);
+    __atomic_store_n(&bucket[victim].data, data, __ATOMIC_RELAXED);
+    __atomic_store_n(&bucket[victim].check, key ^ data, __ATOMIC_RELAXED);
+}
+
+#endif //GOMOKU_MCTS_C_TRANSPOSITION_H